@@ -1,11 +1,15 @@
 #include <sam.h>
 #include "ili9341.h"
+#include "ili9341_convert.h"
 #include "ili9341_regs.h"
 #include "ili9341_pioInterface.h"
 
 #include "../delay.h"
 #include "../spi.h"
 
+#include <stdlib.h>
+#include <string.h>
+
 // Default setting is to send MSB first
 // BASE LEVEL COMMUNICATION
 static void ili9341_select_command_mode();
@@ -13,12 +17,22 @@ static void ili9341_select_data_mode();
 static void ili9341_send_byte(uint32_t data);
 static void ili9341_send_command(uint32_t command);
 
+static void writeCommand(uint8_t command, const uint8_t *parameters, uint32_t count);
 // 
 static uint32_t setAddress(uint32_t start_index, uint32_t *tbuffer, uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1);
 
 #define MAX_ILI9341_PACKAGE_SIZE 500
 static uint32_t dma_transmit_buffer[MAX_ILI9341_PACKAGE_SIZE];
-static uint32_t dma_receive_buffer[MAX_ILI9341_PACKAGE_SIZE];
+// Only readManufactorID reads anything back, everything else is written without a receive buffer
+static uint32_t dma_receive_buffer[5];
+
+#ifdef ILI9341_4WIRE
+// In 4-wire mode pixels are plain uint16_t, and dma_transmit_buffer holds twice as many of them
+#define PIXEL_BUFFER_SIZE (2 * MAX_ILI9341_PACKAGE_SIZE)
+static uint16_t *const pixel_buffer = (uint16_t *)dma_transmit_buffer;
+
+static void writePixelSegments(const struct SpiSegment *segments, uint16_t segment_count);
+#endif
 
 
 static void ili9341_reset_display() {
@@ -45,14 +59,84 @@ static void ili9341_select_data_mode() {
 
 static void ili9341_send_byte(uint32_t data) {
 	dma_transmit_buffer[0] = spi_word(true, ILI9341_CHIP_SELECT, data) ;
-	spi_freeRTOSTranceive(dma_transmit_buffer, 1, 0, dma_receive_buffer);
+	spi_freeRTOSTranceive(dma_transmit_buffer, 1, 0, NULL);
 }
 
 static void ili9341_send_command(uint32_t command) {
+#ifdef ILI9341_4WIRE
+	writeCommand(command, NULL, 0);
+#else
 	dma_transmit_buffer[0] = spi_word(true, ILI9341_CHIP_SELECT, command);
-	spi_freeRTOSTranceive(dma_transmit_buffer, 1, 0, dma_receive_buffer);
+	spi_freeRTOSTranceive(dma_transmit_buffer, 1, 0, NULL);
+#endif
+}
+
+#ifdef ILI9341_4WIRE
+// The D/C pin must not change while a byte is still being shifted out. spi_freeRTOSTranceiveSequence 
+// calls this between the segments with the bus idle. Segments whose bit is set in *user are commands.
+static void setDataOrCommand(void *user, uint16_t segment_index) {
+	if ((*(const uint32_t *)user >> segment_index) & 1) {
+		ili9341_select_command_mode();
+	}
+	else {
+		ili9341_select_data_mode();
+	}
+}
+
+// Commands with their parameters in one go: short ones are polled without letting go of the bus in 
+// between, instead of being two blocking transfers each. D/C is left high for the data that follows.
+static void writeSequence(const struct SpiSegment *segments, uint16_t segment_count, uint32_t commands) {
+	spi_freeRTOSTranceiveSequence(ILI9341_CHIP_SELECT, SPI_FORMAT_PACKED_8, segments, segment_count, setDataOrCommand, &commands);
+	ili9341_select_data_mode();
+}
+
+static void writeCommand(uint8_t command, const uint8_t *parameters, uint32_t count) {
+	struct SpiSegment segments[2] = {
+		{ .transmit_buffer = &command, .receive_buffer = NULL, .length = 1, .repeat = 0 },
+		{ .transmit_buffer = (void *)parameters, .receive_buffer = NULL, .length = count, .repeat = 0 }
+	};
+	writeSequence(segments, (count > 0) ? 2 : 1, 1 << 0);
+}
+
+static void writePixelSegments(const struct SpiSegment *segments, uint16_t segment_count) {
+	spi_freeRTOSTranceiveSequence(ILI9341_CHIP_SELECT, SPI_FORMAT_PACKED_16, segments, segment_count, NULL, NULL);
 }
 
+// CASET, PASET and, if memory_write is set, RAMWR as one sequence
+static void setColumnsAndPages(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, bool memory_write) {
+	uint8_t commands[3] = {ILI9341_CMD_COLUMN_ADDRESS_SET, ILI9341_CMD_PAGE_ADDRESS_SET, ILI9341_CMD_MEMORY_WRITE};
+	uint8_t columns[4] = {x0 >> 8, x0 & 0xFF, x1 >> 8, x1 & 0xFF};
+	uint8_t pages[4] = {y0 >> 8, y0 & 0xFF, y1 >> 8, y1 & 0xFF};
+	struct SpiSegment segments[5] = {
+		{ .transmit_buffer = &commands[0], .receive_buffer = NULL, .length = 1, .repeat = 0 },
+		{ .transmit_buffer = columns, .receive_buffer = NULL, .length = 4, .repeat = 0 },
+		{ .transmit_buffer = &commands[1], .receive_buffer = NULL, .length = 1, .repeat = 0 },
+		{ .transmit_buffer = pages, .receive_buffer = NULL, .length = 4, .repeat = 0 },
+		{ .transmit_buffer = &commands[2], .receive_buffer = NULL, .length = 1, .repeat = 0 }
+	};
+	writeSequence(segments, memory_write ? 5 : 4, (1 << 0) | (1 << 2) | (1 << 4));
+}
+
+void ili9341_setWindow(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1) {
+	setColumnsAndPages(x0, y0, x1, y1, true);
+}
+
+void ili9341_writeMemoryContinue(void) {
+	writeCommand(ILI9341_CMD_WRITE_MEMORY_CONTINUE, NULL, 0);
+}
+
+// The SPI sends the high byte of a 16-bit transfer first, which is the order the ILI9341 wants RGB565 in
+void ili9341_writePixels(const uint16_t *pixels, uint32_t count) {
+	spi_freeRTOSTranceivePacked(ILI9341_CHIP_SELECT, SPI_FORMAT_PACKED_16, (void *)pixels, count, NULL);
+}
+#else
+static void writeCommand(uint8_t command, const uint8_t *parameters, uint32_t count) {
+	dma_transmit_buffer[0] = spi_word(false, ILI9341_CHIP_SELECT, command);
+	spi_encodeWords8(&dma_transmit_buffer[1], parameters, count, ILI9341_CHIP_SELECT, DATA_BIT, false);
+	spi_freeRTOSTranceive(dma_transmit_buffer, count + 1, NULL, NULL);
+}
+#endif
+
 
 void ili9341_exit_standby() {
 	ili9341_send_command(ILI9341_CMD_SLEEP_OUT);
@@ -60,6 +144,32 @@ void ili9341_exit_standby() {
 	ili9341_send_command(ILI9341_CMD_DISPLAY_ON);
 }
 
+// The three areas are in memory rows and must add up to ILI9341_TFTHEIGHT
+void ili9341_setScrollArea(uint16_t top_fixed, uint16_t scroll_height, uint16_t bottom_fixed) {
+	const uint8_t parameters[6] = {top_fixed >> 8, top_fixed & 0xFF, scroll_height >> 8, scroll_height & 0xFF, 
+		bottom_fixed >> 8, bottom_fixed & 0xFF};
+	writeCommand(ILI9341_CMD_VERT_SCROLL_DEFINITION, parameters, 6);
+}
+
+// Memory row shown at the top of the scroll area
+void ili9341_setScrollStart(uint16_t row) {
+	const uint8_t parameters[2] = {row >> 8, row & 0xFF};
+	writeCommand(ILI9341_CMD_VERT_SCROLL_START_ADDRESS, parameters, 2);
+}
+
+// TE pulses once per refresh, at the start of vertical blanking or, if scanline is not 0, when the panel
+// starts refreshing that line
+void ili9341_setTearingEffect(bool on, uint16_t scanline) {
+	if (!on) {
+		writeCommand(ILI9341_CMD_TEARING_EFFECT_LINE_OFF, NULL, 0);
+		return;
+	}
+	const uint8_t line[2] = {scanline >> 8, scanline & 0xFF};
+	const uint8_t mode = 0; // Vertical blanking only, no horizontal pulses
+	writeCommand(ILI9341_CMD_SET_TEAR_SCANLINE, line, 2);
+	writeCommand(ILI9341_CMD_TEARING_EFFECT_LINE_ON, &mode, 1);
+}
+
 void ili9341_enter_standby() {
 	ili9341_send_command(ILI9341_CMD_DISPLAY_OFF);
 	vTaskDelay(150/portTICK_RATE_MS);
@@ -119,22 +229,32 @@ void ili9341_init(void)
 	/* Reset the display */
 	ili9341_reset_display();
 	const uint8_t *addr = init_commands;
+#ifdef ILI9341_4WIRE
+	while (1) {
+		uint8_t count = *addr++;
+		if (count-- == 0) {
+			break;
+		}
+		uint8_t command = *addr++;
+		writeCommand(command, addr, count);
+		addr += count;
+	}
+#else
 	uint32_t dma_index = 0;
 	while (1) {
 		uint8_t count = *addr++;
 		if (count-- == 0) {
-			spi_freeRTOSTranceive(dma_transmit_buffer, (dma_index +1), NULL, dma_receive_buffer);
+			spi_freeRTOSTranceive(dma_transmit_buffer, (dma_index +1), NULL, NULL);
 			break;
 		}
 		dma_transmit_buffer[dma_index] = spi_word(false, ILI9341_CHIP_SELECT, *addr++);
 		++dma_index;
 		//writecommand_cont(*addr++);
-		while (count-- > 0) {
-			dma_transmit_buffer[dma_index] = spi_word(false, ILI9341_CHIP_SELECT, (DATA_BIT |(*addr++)));
-			++dma_index;
-			//writedata8_cont(*addr++);		
-		}
+		spi_encodeWords8(&dma_transmit_buffer[dma_index], addr, count, ILI9341_CHIP_SELECT, DATA_BIT, false);
+		addr += count;
+		dma_index += count;
 	}
+#endif
 	ili9341_send_command(ILI9341_CMD_SLEEP_OUT);
 	vTaskDelay(150/portTICK_RATE_MS);
 	ili9341_send_command(ILI9341_CMD_DISPLAY_ON);
@@ -146,12 +266,17 @@ void ili9341_drawPixel(int16_t x, int16_t y, uint16_t color) {
 
  	if ((x < 0) ||(x >= ILI9341_TFTWIDTH) || (y < 0) || (y >= ILI9341_TFTHEIGHT)) return;
 	 
+#ifdef ILI9341_4WIRE
+	ili9341_setWindow(x, y, x, y);
+	ili9341_writePixels(&color, 1);
+#else
  	uint32_t current_index =	setAddress(0, dma_transmit_buffer, x, y, x, y);
 	dma_transmit_buffer[current_index] =	spi_word(false,ILI9341_CHIP_SELECT, ILI9341_CMD_MEMORY_WRITE);
 	dma_transmit_buffer[current_index+1] =  spi_word(false,ILI9341_CHIP_SELECT, (DATA_BIT | (color >> 8)));
 	dma_transmit_buffer[current_index+2] =  spi_word(false,ILI9341_CHIP_SELECT, (DATA_BIT | (color & 0xFF)));
-	uint32_t transmit_length = current_index + 1;
-	spi_freeRTOSTranceive(dma_transmit_buffer,transmit_length,0,dma_receive_buffer);
+	uint32_t transmit_length = current_index + 3;
+	spi_freeRTOSTranceive(dma_transmit_buffer,transmit_length,0,NULL);
+#endif
  }
 
 
@@ -159,37 +284,735 @@ void ili9341_drawVLine(uint16_t x, uint16_t y, uint16_t h, uint16_t color) {
 	if ((x >= ILI9341_TFTWIDTH) || (y >= ILI9341_TFTHEIGHT)) {
 		return;
 	}
-	if ((y+h-1) >= ILI9341_TFTHEIGHT) {
-		h = ILI9341_TFTHEIGHT-y;
+	// Clamp before h is narrowed to the int16_t of fillRect, where more than 32767 would turn negative
+	if (h > ILI9341_TFTHEIGHT - y) {
+		h = ILI9341_TFTHEIGHT - y;
 	}
-	uint32_t current_index = setAddress(0, dma_transmit_buffer, x,y,x,y+h-1);
+	ili9341_fillRect(x, y, 1, h, color);
+}
+
+// The window is set once, and the pixels that fit in the buffer are sent again and again as a 
+// repeated segment, so a fill of any size is one transfer that only waits for the SPI clock
+void ili9341_fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) {
+	if (!ili9341_clipRect(&x, &y, &w, &h)) {
+		return;
+	}
+	
+#ifdef ILI9341_4WIRE
+	// The window has to go out with D/C low before the pixels, so it is sent first on its own
+	ili9341_setWindow(x, y, x+w-1, y+h-1);
+	uint32_t pixels = (uint32_t)w * h;
+	uint32_t pixels_in_buffer = (pixels < PIXEL_BUFFER_SIZE) ? pixels : PIXEL_BUFFER_SIZE;
+	for (uint32_t i = 0; i < pixels_in_buffer; i++) {
+		pixel_buffer[i] = color;
+	}
+	
+	// The buffer repeated, and what is left over
+	struct SpiSegment segments[2];
+	uint16_t segment_count = 1;
+	segments[0].transmit_buffer = pixel_buffer;
+	segments[0].receive_buffer = NULL;
+	segments[0].length = pixels_in_buffer;
+	segments[0].repeat = pixels / pixels_in_buffer;
+	pixels %= pixels_in_buffer;
+	if (pixels > 0) {
+		segments[1].transmit_buffer = pixel_buffer;
+		segments[1].receive_buffer = NULL;
+		segments[1].length = pixels;
+		segments[1].repeat = 0;
+		segment_count++;
+	}
+	writePixelSegments(segments, segment_count);
+#else
+	uint32_t current_index = setAddress(0, dma_transmit_buffer, x,y,x+w-1,y+h-1);
 	dma_transmit_buffer[current_index] = spi_word(false,ILI9341_CHIP_SELECT, ILI9341_CMD_MEMORY_WRITE);
-	while (h-- >= 1) {
-		current_index = current_index + 2;
-		dma_transmit_buffer[current_index-1]	= spi_word(false,ILI9341_CHIP_SELECT, (DATA_BIT | (color >> 8)));
-		dma_transmit_buffer[current_index]		= spi_word(false,ILI9341_CHIP_SELECT, (DATA_BIT | (color & 0xFF)));
+	uint32_t color_index = current_index + 1;
+	
+	uint32_t pixels = (uint32_t)w * h;
+	uint32_t pixels_in_buffer = (MAX_ILI9341_PACKAGE_SIZE - color_index) / 2;
+	if (pixels < pixels_in_buffer) {
+		pixels_in_buffer = pixels;
+	}
+	uint32_t color_high = spi_word(false,ILI9341_CHIP_SELECT, (DATA_BIT | (color >> 8)));
+	uint32_t color_low = spi_word(false,ILI9341_CHIP_SELECT, (DATA_BIT | (color & 0xFF)));
+	for (uint32_t i = 0; i < pixels_in_buffer; i++) {
+		dma_transmit_buffer[color_index + 2*i]		= color_high;
+		dma_transmit_buffer[color_index + 2*i + 1]	= color_low;
+	}
+	
+	// Window and the first buffer of pixels, the buffer repeated, and what is left over
+	struct SpiSegment segments[3];
+	uint16_t segment_count = 1;
+	segments[0].transmit_buffer = dma_transmit_buffer;
+	segments[0].receive_buffer = NULL;
+	segments[0].length = color_index + 2 * pixels_in_buffer;
+	segments[0].repeat = 0;
+	pixels -= pixels_in_buffer;
+	if (pixels >= pixels_in_buffer) {
+		segments[segment_count].transmit_buffer = &dma_transmit_buffer[color_index];
+		segments[segment_count].receive_buffer = NULL;
+		segments[segment_count].length = 2 * pixels_in_buffer;
+		segments[segment_count].repeat = pixels / pixels_in_buffer;
+		segment_count++;
+		pixels %= pixels_in_buffer;
+	}
+	if (pixels > 0) {
+		segments[segment_count].transmit_buffer = &dma_transmit_buffer[color_index];
+		segments[segment_count].receive_buffer = NULL;
+		segments[segment_count].length = 2 * pixels;
+		segments[segment_count].repeat = 0;
+		segment_count++;
+	}
+	spi_freeRTOSTranceiveSegments(segments, segment_count);
+#endif
+}
+
+void ili9341_fillScreen(uint16_t color) {
+	ili9341_fillRect(0, 0, ILI9341_TFTWIDTH, ILI9341_TFTHEIGHT, color);
+}
+
+void ili9341_drawHLine(int16_t x, int16_t y, int16_t w, uint16_t color) {
+	if ((x < ILI9341_TFTWIDTH) && (w > ILI9341_TFTWIDTH - x)) {
+		w = ILI9341_TFTWIDTH - x;
+	}
+	ili9341_fillRect(x, y, w, 1, color);
+}
+
+// Lines and outlines are drawn as runs of pixels in a row or a column. Every run gets its own window 
+// and RAMWR, and the runs are collected in dma_transmit_buffer and sent together as one transfer.
+// In 4-wire mode a window cannot share a transfer with pixels, so every run is a fill of its own.
+static uint32_t run_index = 0;
+
+static void flushRuns() {
+	if (run_index > 0) {
+		spi_freeRTOSTranceive(dma_transmit_buffer, run_index, NULL, NULL);
+		run_index = 0;
+	}
+}
+
+static void addRun(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) {
+#ifdef ILI9341_4WIRE
+	ili9341_fillRect(x, y, w, h, color);
+#else
+	if (!ili9341_clipRect(&x, &y, &w, &h)) {
+		return;
+	}
+	uint32_t pixels = (uint32_t)w * h;
+	uint32_t run_length = 11 + 2 * pixels;
+	if (run_length > MAX_ILI9341_PACKAGE_SIZE) {
+		// Does not fit in the buffer at all, so it is streamed on its own
+		flushRuns();
+		ili9341_fillRect(x, y, w, h, color);
+		return;
+	}
+	if (run_index + run_length > MAX_ILI9341_PACKAGE_SIZE) {
+		flushRuns();
+	}
+	run_index = setAddress(run_index, dma_transmit_buffer, x, y, x+w-1, y+h-1);
+	dma_transmit_buffer[run_index++] = spi_word(false,ILI9341_CHIP_SELECT, ILI9341_CMD_MEMORY_WRITE);
+	uint32_t color_high = spi_word(false,ILI9341_CHIP_SELECT, (DATA_BIT | (color >> 8)));
+	uint32_t color_low = spi_word(false,ILI9341_CHIP_SELECT, (DATA_BIT | (color & 0xFF)));
+	for (uint32_t i = 0; i < pixels; i++) {
+		dma_transmit_buffer[run_index++] = color_high;
+		dma_transmit_buffer[run_index++] = color_low;
+	}
+#endif
+}
+
+// Bresenham, walking the long axis and cutting a run every time the short axis steps
+bool ili9341_lineRuns(int16_t x0, int16_t y0, int16_t x1, int16_t y1, Ili9341RunFunc run, void *user) {
+	bool steep = abs(y1 - y0) > abs(x1 - x0);
+	int16_t swap;
+	if (steep) {
+		swap = x0; x0 = y0; y0 = swap;
+		swap = x1; x1 = y1; y1 = swap;
+	}
+	if (x0 > x1) {
+		swap = x0; x0 = x1; x1 = swap;
+		swap = y0; y0 = y1; y1 = swap;
+	}
+	int16_t dx = x1 - x0;
+	int16_t dy = abs(y1 - y0);
+	int16_t err = dx / 2;
+	int16_t ystep = (y0 < y1) ? 1 : -1;
+	int16_t run_start = x0;
+	
+	for (int16_t x = x0; x <= x1; x++) {
+		err -= dy;
+		if ((err < 0) || (x == x1)) {
+			bool more;
+			if (steep) {
+				more = run(user, y0, run_start, 1, x - run_start + 1);
+			}
+			else {
+				more = run(user, run_start, y0, x - run_start + 1, 1);
+			}
+			if (!more) {
+				return false;
+			}
+			run_start = x + 1;
+		}
+		if (err < 0) {
+			y0 += ystep;
+			err += dx;
+		}
+	}
+	return true;
+}
+
+static bool drawRun(void *user, int16_t x, int16_t y, int16_t w, int16_t h) {
+	addRun(x, y, w, h, *(const uint16_t *)user);
+	return true;
+}
+
+void ili9341_drawLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1, uint16_t color) {
+	ili9341_lineRuns(x0, y0, x1, y1, drawRun, &color);
+	flushRuns();
+}
+
+void ili9341_drawRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) {
+	if ((w <= 0) || (h <= 0)) {
+		return;
+	}
+	addRun(x, y, w, 1, color);
+	if (h > 1) {
+		addRun(x, y+h-1, w, 1, color);
+	}
+	if (h > 2) {
+		addRun(x, y+1, 1, h-2, color);
+		if (w > 1) {
+			addRun(x+w-1, y+1, 1, h-2, color);
+		}
+	}
+	flushRuns();
+}
+
+// Cut a rectangle down to the part that is on the screen. Returns false if nothing is left.
+bool ili9341_clipRect(int16_t *x, int16_t *y, int16_t *w, int16_t *h) {
+	if (*x < 0) {
+		*w += *x;
+		*x = 0;
+	}
+	if (*y < 0) {
+		*h += *y;
+		*y = 0;
+	}
+	if ((*w <= 0) || (*h <= 0) || (*x >= ILI9341_TFTWIDTH) || (*y >= ILI9341_TFTHEIGHT)) {
+		return false;
+	}
+	if ((*x + *w - 1) >= ILI9341_TFTWIDTH) {
+		*w = ILI9341_TFTWIDTH - *x;
+	}
+	if ((*y + *h - 1) >= ILI9341_TFTHEIGHT) {
+		*h = ILI9341_TFTHEIGHT - *y;
+	}
+	return true;
+}
+
+uint32_t ili9341_encodeWindow(uint32_t *tbuffer, uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1) {
+	uint32_t index = setAddress(0, tbuffer, x0, y0, x1, y1);
+	tbuffer[index] = spi_word(false,ILI9341_CHIP_SELECT, ILI9341_CMD_MEMORY_WRITE);
+	return index + 1;
+}
+
+// Pixel streams are collected in pieces of up to ILI9341_PIECE_PIXELS in two PDC buffers, 
+// so one piece is filled while the other is on the bus
+#ifdef ILI9341_4WIRE
+#define PIECE_WORDS ILI9341_PIECE_PIXELS
+#else
+#define PIECE_WORDS (ILI9341_WINDOW_WORDS + 2 * ILI9341_PIECE_PIXELS)
+#endif
+static Ili9341PixelWord piece_buffer[2][PIECE_WORDS];
+static struct SpiTransfer piece_transfer[2];
+static bool piece_in_flight[2];
+static uint8_t piece_next = 0;
+// The piece being filled and the words in it so far
+static bool piece_is_open = false;
+static uint8_t piece_open;
+static uint32_t piece_length;
+static bool stream_first;
+#ifndef ILI9341_4WIRE
+static uint16_t stream_window[4];
+#endif
+
+static void waitForPiece(uint8_t piece) {
+	if (piece_in_flight[piece]) {
+		spi_waitForTransfer(&piece_transfer[piece]);
+		piece_in_flight[piece] = false;
+	}
+}
+
+// The pieces after the first start with Write Memory Continue in case the chip select was released in between
+static void openPiece(void) {
+	piece_open = piece_next;
+	piece_next ^= 1;
+	waitForPiece(piece_open);
+	piece_is_open = true;
+#ifdef ILI9341_4WIRE
+	// Write Memory Continue needs D/C low, so it is sent on its own in sendPiece
+	piece_length = 0;
+#else
+	Ili9341PixelWord *words = piece_buffer[piece_open];
+	if (stream_first) {
+		piece_length = ili9341_encodeWindow(words, stream_window[0], stream_window[1], stream_window[2], stream_window[3]);
 	}
-	spi_freeRTOSTranceive(dma_transmit_buffer, (current_index + 1), NULL, dma_receive_buffer);
+	else {
+		words[0] = spi_word(false,ILI9341_CHIP_SELECT, ILI9341_CMD_WRITE_MEMORY_CONTINUE);
+		piece_length = 1;
+	}
+#endif
+}
+
+static void sendPiece(void) {
+	uint8_t piece = piece_open;
+	piece_is_open = false;
+#ifdef ILI9341_4WIRE
+	// D/C may only change with the piece before off the bus, so the pieces are not chained in the PDC. 
+	// The next piece is still filled while this one is sent.
+	waitForPiece(piece ^ 1);
+	if (!stream_first) {
+		ili9341_writeMemoryContinue();
+	}
+	enum SpiWordFormat format = SPI_FORMAT_PACKED_16;
+#else
+	enum SpiWordFormat format = SPI_FORMAT_PDC_WORD;
+#endif
+	stream_first = false;
+	piece_transfer[piece] = (struct SpiTransfer){
+		.transmit_buffer = piece_buffer[piece],
+		.receive_buffer = NULL,
+		.buffer_length = piece_length,
+		.segments = NULL,
+		.format = format,
+		.chip_select = ILI9341_CHIP_SELECT,
+		.callBackFunc = NULL,
+		.user = NULL,
+		.notify_task = xTaskGetCurrentTaskHandle()
+	};
+	piece_in_flight[piece] = true;
+	spi_submitTransfer(&piece_transfer[piece]);
+}
+
+// Whole pixels that still fit in the open piece, opening one if there is none
+static uint32_t pieceRoom(void) {
+	if (!piece_is_open) {
+		openPiece();
+	}
+	return (PIECE_WORDS - piece_length) / ILI9341_WORDS_PER_PIXEL;
+}
+
+void ili9341_encodePixels(Ili9341PixelWord *words, const uint16_t *pixels, uint32_t count) {
+#ifdef ILI9341_4WIRE
+	for (uint32_t i = 0; i < count; i++) {
+		words[i] = pixels[i];
+	}
+#else
+	uint32_t data_word = spi_word(false,ILI9341_CHIP_SELECT, DATA_BIT);
+	for (uint32_t i = 0; i < count; i++) {
+		*words++ = data_word | (pixels[i] >> 8);
+		*words++ = data_word | (pixels[i] & 0xFF);
+	}
+#endif
+}
+
+void ili9341_streamBegin(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1) {
+#ifdef ILI9341_4WIRE
+	// D/C changes for the window, so the pieces of the last stream must be off the bus
+	ili9341_streamEnd();
+	ili9341_setWindow(x0, y0, x1, y1);
+#else
+	// The window goes out in front of the first piece
+	if (piece_is_open) {
+		sendPiece();
+	}
+	stream_window[0] = x0;
+	stream_window[1] = y0;
+	stream_window[2] = x1;
+	stream_window[3] = y1;
+#endif
+	stream_first = true;
+}
+
+void ili9341_streamPixels(const uint16_t *pixels, uint32_t count) {
+	while (count > 0) {
+		uint32_t room = pieceRoom();
+		uint32_t pixels_now = (count < room) ? count : room;
+		ili9341_encodePixels(&piece_buffer[piece_open][piece_length], pixels, pixels_now);
+		piece_length += pixels_now * ILI9341_WORDS_PER_PIXEL;
+		pixels += pixels_now;
+		count -= pixels_now;
+		if (pixels_now == room) {
+			sendPiece();
+		}
+	}
+}
+
+// The two data words of a pixel in 3-wire mode are encoded once and copied for the whole run
+void ili9341_streamRun(uint16_t color, uint32_t count) {
+	Ili9341PixelWord color_words[ILI9341_WORDS_PER_PIXEL];
+	ili9341_encodePixels(color_words, &color, 1);
+	while (count > 0) {
+		uint32_t room = pieceRoom();
+		uint32_t pixels_now = (count < room) ? count : room;
+		Ili9341PixelWord *words = &piece_buffer[piece_open][piece_length];
+		for (uint32_t i = 0; i < pixels_now; i++) {
+			for (uint8_t j = 0; j < ILI9341_WORDS_PER_PIXEL; j++) {
+				*words++ = color_words[j];
+			}
+		}
+		piece_length += pixels_now * ILI9341_WORDS_PER_PIXEL;
+		count -= pixels_now;
+		if (pixels_now == room) {
+			sendPiece();
+		}
+	}
+}
+
+void ili9341_streamPixelBytes(const uint8_t *bytes, uint32_t count) {
+	while (count > 0) {
+		uint32_t room = pieceRoom();
+		uint32_t pixels_now = (count < room) ? count : room;
+		Ili9341PixelWord *words = &piece_buffer[piece_open][piece_length];
+#ifdef ILI9341_4WIRE
+		for (uint32_t i = 0; i < pixels_now; i++) {
+			words[i] = (bytes[2*i] << 8) | bytes[2*i + 1];
+		}
+#else
+		spi_encodeWords8(words, bytes, 2 * pixels_now, ILI9341_CHIP_SELECT, DATA_BIT, false);
+#endif
+		piece_length += pixels_now * ILI9341_WORDS_PER_PIXEL;
+		bytes += 2 * pixels_now;
+		count -= pixels_now;
+		if (pixels_now == room) {
+			sendPiece();
+		}
+	}
+}
+
+void ili9341_streamWords(const Ili9341PixelWord *words, uint32_t count) {
+	while (count > 0) {
+		uint32_t room = pieceRoom() * ILI9341_WORDS_PER_PIXEL;
+		uint32_t words_now = (count < room) ? count : room;
+		memcpy(&piece_buffer[piece_open][piece_length], words, words_now * sizeof(Ili9341PixelWord));
+		piece_length += words_now;
+		words += words_now;
+		count -= words_now;
+		if (words_now == room) {
+			sendPiece();
+		}
+	}
+}
+
+void ili9341_streamEnd(void) {
+	if (piece_is_open) {
+		sendPiece();
+	}
+	waitForPiece(0);
+	waitForPiece(1);
+}
+
+void ili9341_writeRect(int16_t x, int16_t y, int16_t w, int16_t h, const uint16_t *pixels) {
+	ili9341_writeRectFormat(x, y, w, h, pixels, ILI9341_FORMAT_RGB565);
+}
+
+// Other formats are converted a piece at a time into convert_buffer. The stream copies it into a PDC buffer, 
+// so the next piece is converted while the one before is sent and the bus does not wait for the conversion.
+static uint16_t convert_buffer[ILI9341_PIECE_PIXELS];
+
+void ili9341_writeRectFormat(int16_t x, int16_t y, int16_t w, int16_t h, const void *pixels, enum Ili9341PixelFormat format) {
+	int16_t visible_x = x;
+	int16_t visible_y = y;
+	int16_t visible_w = w;
+	int16_t visible_h = h;
+	if (!ili9341_clipRect(&visible_x, &visible_y, &visible_w, &visible_h)) {
+		return;
+	}
+	uint8_t pixel_bytes = ili9341_bytesPerPixel(format);
+	const uint8_t *row = (const uint8_t *)pixels + ((uint32_t)(visible_y - y) * w + (visible_x - x)) * pixel_bytes;
+	// Whole rows follow each other in the source and are sent as one run
+	uint32_t run_pixels = visible_w;
+	int16_t runs = visible_h;
+	if (visible_w == w) {
+		run_pixels = (uint32_t)w * visible_h;
+		runs = 1;
+	}
+	
+	ili9341_streamBegin(visible_x, visible_y, visible_x+visible_w-1, visible_y+visible_h-1);
+	for (int16_t run = 0; run < runs; run++) {
+		if (format == ILI9341_FORMAT_RGB565) {
+			ili9341_streamPixels((const uint16_t *)row, run_pixels);
+		}
+		else {
+			for (uint32_t offset = 0; offset < run_pixels; offset += ILI9341_PIECE_PIXELS) {
+				uint32_t count = (run_pixels - offset < ILI9341_PIECE_PIXELS) ? (run_pixels - offset) : ILI9341_PIECE_PIXELS;
+				ili9341_convert(convert_buffer, row + offset * pixel_bytes, count, format);
+				ili9341_streamPixels(convert_buffer, count);
+			}
+		}
+		row += (uint32_t)w * pixel_bytes;
+	}
+	ili9341_streamEnd();
+}
+
+// GRAM is read back in chunks of up to ILI9341_READ_CHUNK_PIXELS: whole rows if a row fits in a chunk, 
+// otherwise pieces of one row. Every chunk sets its own window, so chunks can be read and written in any order.
+struct ReadChunk {
+	int16_t x;
+	int16_t y;
+	int16_t w;
+	int16_t h;
+};
+
+static uint32_t chunkCount(int16_t w, int16_t h) {
+	if (w <= ILI9341_READ_CHUNK_PIXELS) {
+		int16_t rows = ILI9341_READ_CHUNK_PIXELS / w;
+		return (h + rows - 1) / rows;
+	}
+	return (uint32_t)h * ((w + ILI9341_READ_CHUNK_PIXELS - 1) / ILI9341_READ_CHUNK_PIXELS);
+}
+
+static void chunkAt(int16_t x, int16_t y, int16_t w, int16_t h, uint32_t index, struct ReadChunk *chunk) {
+	if (w <= ILI9341_READ_CHUNK_PIXELS) {
+		int16_t rows = ILI9341_READ_CHUNK_PIXELS / w;
+		chunk->x = x;
+		chunk->w = w;
+		chunk->y = y + index * rows;
+		chunk->h = (y + h - chunk->y < rows) ? (y + h - chunk->y) : rows;
+	}
+	else {
+		uint32_t pieces = (w + ILI9341_READ_CHUNK_PIXELS - 1) / ILI9341_READ_CHUNK_PIXELS;
+		chunk->y = y + index / pieces;
+		chunk->h = 1;
+		chunk->x = x + (index % pieces) * ILI9341_READ_CHUNK_PIXELS;
+		chunk->w = (x + w - chunk->x < ILI9341_READ_CHUNK_PIXELS) ? (x + w - chunk->x) : ILI9341_READ_CHUNK_PIXELS;
+	}
+}
+
+// Memory Read answers with a dummy byte, then with three bytes per pixel that hold 6 bits of red, 
+// green and blue in their top bits, whatever the pixel format for writing is
+#ifdef ILI9341_4WIRE
+// Read Memory, the dummy byte and the pixels
+#define READ_BYTES (2 + 3 * ILI9341_READ_CHUNK_PIXELS)
+static uint8_t read_command[READ_BYTES];
+static uint8_t read_bytes[2][READ_BYTES];
+#define READ_BYTE(slot, i) (read_bytes[slot][2 + (i)])
+#else
+// The window with Read Memory instead of Write Memory, and the dummy byte
+#define READ_HEADER_WORDS (ILI9341_WINDOW_WORDS + 1)
+#define READ_WORDS (READ_HEADER_WORDS + 3 * ILI9341_READ_CHUNK_PIXELS)
+static uint32_t read_header[2][READ_HEADER_WORDS];
+static uint32_t read_dummies[3 * ILI9341_READ_CHUNK_PIXELS];
+// Received into, and then reused for the chunk when it is written back
+static uint32_t read_words[2][READ_WORDS];
+static struct SpiSegment read_segments[2][2];
+static struct SpiTransfer read_transfer[2];
+static struct SpiTransfer write_transfer[2];
+static bool write_in_flight[2];
+// Every received word holds one byte in its low 8 bits, as for ili9341_readManufactorID
+#define READ_BYTE(slot, i) ((uint8_t)read_words[slot][READ_HEADER_WORDS + (i)])
+#endif
+static uint16_t blend_pixels[ILI9341_READ_CHUNK_PIXELS];
+
+#ifdef ILI9341_4WIRE
+// The command and the clocks for the answer go out as one transfer with D/C low, as in ili9341_readManufactorID. 
+// Everything is blocking, so a chunk is read and written back before the next one is read.
+static void startRead(uint8_t slot, const struct ReadChunk *chunk) {
+	if (read_command[0] == 0) {
+		memset(read_command, DUMMY_BYTE, sizeof(read_command));
+		read_command[0] = ILI9341_CMD_MEMORY_READ;
+	}
+	setColumnsAndPages(chunk->x, chunk->y, chunk->x+chunk->w-1, chunk->y+chunk->h-1, false);
+	ili9341_select_command_mode();
+	spi_freeRTOSTranceivePacked(ILI9341_CHIP_SELECT, SPI_FORMAT_PACKED_8, read_command, 2 + 3 * (uint32_t)chunk->w * chunk->h, read_bytes[slot]);
+	ili9341_select_data_mode();
+}
+
+static void waitForRead(uint8_t slot) {
+}
+
+static void startWrite(uint8_t slot, const struct ReadChunk *chunk, const uint16_t *pixels) {
+	ili9341_setWindow(chunk->x, chunk->y, chunk->x+chunk->w-1, chunk->y+chunk->h-1);
+	ili9341_writePixels(pixels, (uint32_t)chunk->w * chunk->h);
+}
+
+static void waitForWrite(uint8_t slot) {
+}
+#else
+// A read is the header, and the dummy words that clock the pixels in as a second segment
+static void startRead(uint8_t slot, const struct ReadChunk *chunk) {
+	if (read_dummies[0] == 0) {
+		for (uint32_t i = 0; i < 3 * ILI9341_READ_CHUNK_PIXELS; i++) {
+			read_dummies[i] = spi_word(false,ILI9341_CHIP_SELECT, (DATA_BIT | DUMMY_BYTE));
+		}
+	}
+	uint32_t *header = read_header[slot];
+	uint32_t index = setAddress(0, header, chunk->x, chunk->y, chunk->x+chunk->w-1, chunk->y+chunk->h-1);
+	header[index++] = spi_word(false,ILI9341_CHIP_SELECT, ILI9341_CMD_MEMORY_READ);
+	header[index++] = spi_word(false,ILI9341_CHIP_SELECT, (DATA_BIT | DUMMY_BYTE));
+
+	struct SpiSegment *segments = read_segments[slot];
+	segments[0] = (struct SpiSegment){header, read_words[slot], READ_HEADER_WORDS, 0};
+	segments[1] = (struct SpiSegment){read_dummies, &read_words[slot][READ_HEADER_WORDS], 3 * (uint32_t)chunk->w * chunk->h, 0};
+	read_transfer[slot] = (struct SpiTransfer){
+		.segments = segments,
+		.segment_count = 2,
+		.format = SPI_FORMAT_PDC_WORD,
+		.chip_select = ILI9341_CHIP_SELECT,
+		.callBackFunc = NULL,
+		.user = NULL,
+		.notify_task = xTaskGetCurrentTaskHandle()
+	};
+	spi_submitTransfer(&read_transfer[slot]);
+}
+
+static void waitForRead(uint8_t slot) {
+	spi_waitForTransfer(&read_transfer[slot]);
+}
+
+// The chunk is encoded into the words it was received into, which are a little longer than it needs
+static void startWrite(uint8_t slot, const struct ReadChunk *chunk, const uint16_t *pixels) {
+	uint32_t *words = read_words[slot];
+	uint32_t pixel_count = (uint32_t)chunk->w * chunk->h;
+	uint32_t length = ili9341_encodeWindow(words, chunk->x, chunk->y, chunk->x+chunk->w-1, chunk->y+chunk->h-1);
+	ili9341_encodePixels(&words[length], pixels, pixel_count);
+	write_transfer[slot] = (struct SpiTransfer){
+		.transmit_buffer = words,
+		.receive_buffer = NULL,
+		.buffer_length = length + 2 * pixel_count,
+		.segments = NULL,
+		.format = SPI_FORMAT_PDC_WORD,
+		.chip_select = ILI9341_CHIP_SELECT,
+		.callBackFunc = NULL,
+		.user = NULL,
+		.notify_task = xTaskGetCurrentTaskHandle()
+	};
+	write_in_flight[slot] = true;
+	spi_submitTransfer(&write_transfer[slot]);
+}
+
+static void waitForWrite(uint8_t slot) {
+	if (write_in_flight[slot]) {
+		spi_waitForTransfer(&write_transfer[slot]);
+		write_in_flight[slot] = false;
+	}
+}
+#endif
+
+static void decodeChunk(uint8_t slot, const struct ReadChunk *chunk, uint16_t *pixels, uint32_t stride) {
+	uint32_t i = 0;
+	for (int16_t row = 0; row < chunk->h; row++) {
+		for (int16_t column = 0; column < chunk->w; column++) {
+			uint8_t red = READ_BYTE(slot, i);
+			uint8_t green = READ_BYTE(slot, i + 1);
+			uint8_t blue = READ_BYTE(slot, i + 2);
+			pixels[column] = ((red & 0xF8) << 8) | ((green & 0xFC) << 3) | (blue >> 3);
+			i += 3;
+		}
+		pixels += stride;
+	}
+}
+
+// The next chunk is already on the bus while one is decoded
+void ili9341_readRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t *pixels) {
+	int16_t visible_x = x;
+	int16_t visible_y = y;
+	int16_t visible_w = w;
+	int16_t visible_h = h;
+	if (!ili9341_clipRect(&visible_x, &visible_y, &visible_w, &visible_h)) {
+		return;
+	}
+	ili9341_streamEnd();
+	struct ReadChunk chunks[2];
+	uint32_t count = chunkCount(visible_w, visible_h);
+	chunkAt(visible_x, visible_y, visible_w, visible_h, 0, &chunks[0]);
+	startRead(0, &chunks[0]);
+	for (uint32_t index = 0; index < count; index++) {
+		uint8_t slot = index & 1;
+		if (index + 1 < count) {
+			chunkAt(visible_x, visible_y, visible_w, visible_h, index + 1, &chunks[slot ^ 1]);
+			startRead(slot ^ 1, &chunks[slot ^ 1]);
+		}
+		waitForRead(slot);
+		const struct ReadChunk *chunk = &chunks[slot];
+		decodeChunk(slot, chunk, &pixels[(uint32_t)(chunk->y - y) * w + (chunk->x - x)], w);
+	}
+}
+
+uint16_t ili9341_readPixel(int16_t x, int16_t y) {
+	uint16_t color = 0;
+	ili9341_readRect(x, y, 1, 1, &color);
+	return color;
+}
+
+// Read, blend and write back are pipelined over two chunk buffers. While a chunk is blended the next one 
+// is read, and its write back is queued behind that read, so the bus only waits when blending is slower 
+// than reading a chunk.
+void ili9341_blendRect(int16_t x, int16_t y, int16_t w, int16_t h, Ili9341BlendFunc blend, void *user) {
+	if (!ili9341_clipRect(&x, &y, &w, &h)) {
+		return;
+	}
+	ili9341_streamEnd();
+	struct ReadChunk chunks[2];
+	uint32_t count = chunkCount(w, h);
+	chunkAt(x, y, w, h, 0, &chunks[0]);
+	startRead(0, &chunks[0]);
+	for (uint32_t index = 0; index < count; index++) {
+		uint8_t slot = index & 1;
+		if (index + 1 < count) {
+			// The other buffer still holds the chunk before, until it is written back
+			waitForWrite(slot ^ 1);
+			chunkAt(x, y, w, h, index + 1, &chunks[slot ^ 1]);
+			startRead(slot ^ 1, &chunks[slot ^ 1]);
+		}
+		waitForRead(slot);
+		const struct ReadChunk *chunk = &chunks[slot];
+		decodeChunk(slot, chunk, blend_pixels, chunk->w);
+		blend(user, blend_pixels, chunk->x, chunk->y, chunk->w, chunk->h);
+		startWrite(slot, chunk, blend_pixels);
+	}
+	waitForWrite(0);
+	waitForWrite(1);
+}
+
+struct AlphaFill {
+	uint16_t color;
+	uint8_t alpha;
+};
+
+static void blendFill(void *user, uint16_t *pixels, int16_t x, int16_t y, int16_t w, int16_t h) {
+	const struct AlphaFill *fill = user;
+	ili9341_blendColor(pixels, (uint32_t)w * h, fill->color, fill->alpha);
+}
+
+void ili9341_fillRectAlpha(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color, uint8_t alpha) {
+	struct AlphaFill fill = {color, alpha};
+	ili9341_blendRect(x, y, w, h, blendFill, &fill);
 }
 
 static uint32_t setAddress(uint32_t start_index, uint32_t *tbuffer, uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1) {
+	const uint8_t columns[4] = {x0 >> 8, x0 & 0xFF, x1 >> 8, x1 & 0xFF};
+	const uint8_t pages[4] = {y0 >> 8, y0 & 0xFF, y1 >> 8, y1 & 0xFF};
 	tbuffer[start_index]   = spi_word(false,ILI9341_CHIP_SELECT, ILI9341_CMD_COLUMN_ADDRESS_SET);
-	tbuffer[start_index+1] = spi_word(false,ILI9341_CHIP_SELECT, (DATA_BIT | (x0 >> 8)));
-	tbuffer[start_index+2] = spi_word(false,ILI9341_CHIP_SELECT, (DATA_BIT | (x0 & 0xFF)));
-	tbuffer[start_index+3] = spi_word(false,ILI9341_CHIP_SELECT, (DATA_BIT | (x1 >> 8)));
-	tbuffer[start_index+4] = spi_word(false,ILI9341_CHIP_SELECT, (DATA_BIT | (x1 & 0xFF)));
+	spi_encodeWords8(&tbuffer[start_index+1], columns, 4, ILI9341_CHIP_SELECT, DATA_BIT, false);
 	
 	tbuffer[start_index+5] = spi_word(false,ILI9341_CHIP_SELECT, ILI9341_CMD_PAGE_ADDRESS_SET);
-	tbuffer[start_index+6] = spi_word(false,ILI9341_CHIP_SELECT, (DATA_BIT | (y0 >> 8)));
-	tbuffer[start_index+7] = spi_word(false,ILI9341_CHIP_SELECT, (DATA_BIT | (y0 & 0xFF)));
-	tbuffer[start_index+8] = spi_word(false,ILI9341_CHIP_SELECT, (DATA_BIT | (y1 >> 8)));
-	tbuffer[start_index+9] = spi_word(false,ILI9341_CHIP_SELECT, (DATA_BIT | (y1 & 0xFF)));
+	spi_encodeWords8(&tbuffer[start_index+6], pages, 4, ILI9341_CHIP_SELECT, DATA_BIT, false);
 	
 	return (start_index + 10);
 }
 
 
 void ili9341_readManufactorID() {
+#ifdef ILI9341_4WIRE
+	// D/C is only sampled for bytes the ILI9341 receives, not while it is answering a read, so the command 
+	// and the clocks for the answer go out as one transfer with D/C low and the chip select held down
+	uint8_t *transmit = (uint8_t *)dma_transmit_buffer;
+	transmit[0] = ILI9341_CMD_READ_DISP_ID;
+	transmit[1] = transmit[2] = transmit[3] = transmit[4] = DUMMY_BYTE;
+	ili9341_select_command_mode();
+	spi_freeRTOSTranceivePacked(ILI9341_CHIP_SELECT, SPI_FORMAT_PACKED_8, transmit, 5, dma_receive_buffer);
+	ili9341_select_data_mode();
+#else
 	dma_transmit_buffer[0] = spi_word(false,ILI9341_CHIP_SELECT, ILI9341_CMD_READ_DISP_ID);
 	//dma_transmit_buffer[0] = spi_word(false,ILI9341_CHIP_SELECT, 0x0B);
 	dma_transmit_buffer[1] = spi_word(false,ILI9341_CHIP_SELECT, (DATA_BIT | DUMMY_BYTE));
@@ -197,4 +1020,5 @@ void ili9341_readManufactorID() {
 	dma_transmit_buffer[3] = spi_word(false,ILI9341_CHIP_SELECT, (DATA_BIT | DUMMY_BYTE));
 	dma_transmit_buffer[4] = spi_word(false,ILI9341_CHIP_SELECT, (DATA_BIT | DUMMY_BYTE));
 	spi_freeRTOSTranceive(dma_transmit_buffer,5, NULL, dma_receive_buffer);
+#endif
 }
\ No newline at end of file
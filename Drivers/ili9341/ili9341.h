@@ -1,6 +1,10 @@
 #ifndef ILI9341_H_
 #define ILI9341_H_
 
+#include <stdint.h>
+#include <stdbool.h>
+#include "ili9341_pioInterface.h"
+
 // Bit which is sent along with data to let the ili9341 know 
 // that the incoming byte is data or parameter and not a command
 #define DATA_BIT (1<<8)
@@ -8,12 +12,89 @@
 
 #define ILI9341_TFTWIDTH	240
 #define ILI9341_TFTHEIGHT	320
+// Words ili9341_encodeWindow writes
+#define ILI9341_WINDOW_WORDS	11
+// Pixels a stream copies into a PDC buffer at a time. Two buffers are used, so one is filled while the other is sent.
+#define ILI9341_PIECE_PIXELS	128
+// Pixels ili9341_readRect and ili9341_blendRect read at a time, also into two buffers
+#define ILI9341_READ_CHUNK_PIXELS	64
+
+// What the bus takes for one pixel, two spi_word data words in 3-wire mode and one 16-bit transfer in 4-wire mode
+#ifdef ILI9341_4WIRE
+typedef uint16_t Ili9341PixelWord;
+#define ILI9341_WORDS_PER_PIXEL	1
+#else
+typedef uint32_t Ili9341PixelWord;
+#define ILI9341_WORDS_PER_PIXEL	2
+#endif
+
+enum Ili9341PixelFormat {
+	ILI9341_FORMAT_RGB565 = 0,
+	// Three bytes per pixel, red first
+	ILI9341_FORMAT_RGB888,
+	// uint32_t 0xAARRGGBB. Alpha is ignored.
+	ILI9341_FORMAT_ARGB8888,
+	// One byte per pixel
+	ILI9341_FORMAT_GRAY8
+};
 
 void ili9341_init();
 void ili9341_enter_standby();
 void ili9341_exit_standby();
+// Vertical scrolling. The rows of the scroll area are shown starting at the memory row given to 
+// ili9341_setScrollStart, and wrap around inside the area. Drawing always uses memory rows.
+void ili9341_setScrollArea(uint16_t top_fixed, uint16_t scroll_height, uint16_t bottom_fixed);
+void ili9341_setScrollStart(uint16_t row);
+void ili9341_setTearingEffect(bool on, uint16_t scanline);
 
 void ili9341_readManufactorID();
 void ili9341_drawPixel(int16_t x, int16_t y, uint16_t color);
 void ili9341_drawVLine(uint16_t x, uint16_t y, uint16_t h, uint16_t color);
+void ili9341_fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color);
+void ili9341_fillScreen(uint16_t color);
+void ili9341_drawHLine(int16_t x, int16_t y, int16_t w, uint16_t color);
+void ili9341_drawLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1, uint16_t color);
+// Gets the runs of pixels a line is made of, as rectangles one pixel wide or high. Returning false stops the walk.
+typedef bool (*Ili9341RunFunc)(void *user, int16_t x, int16_t y, int16_t w, int16_t h);
+// Returns false if run stopped the walk
+bool ili9341_lineRuns(int16_t x0, int16_t y0, int16_t x1, int16_t y1, Ili9341RunFunc run, void *user);
+void ili9341_drawRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color);
+// Cut a rectangle down to the part that is on the screen. Returns false if nothing is left.
+bool ili9341_clipRect(int16_t *x, int16_t *y, int16_t *w, int16_t *h);
+// Encode CASET, PASET and RAMWR for the window into tbuffer. The pixels follow as two data words each.
+uint32_t ili9341_encodeWindow(uint32_t *tbuffer, uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1);
+// pixels is w*h values row by row. Only the part that is on the screen is sent.
+void ili9341_writeRect(int16_t x, int16_t y, int16_t w, int16_t h, const uint16_t *pixels);
+void ili9341_writeRectFormat(int16_t x, int16_t y, int16_t w, int16_t h, const void *pixels, enum Ili9341PixelFormat format);
+// Send pixels behind a window without waiting for the bus. The pixels are copied before 
+// ili9341_streamPixels returns, and ili9341_streamEnd sends what is left and waits until it is done.
+void ili9341_streamBegin(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1);
+void ili9341_streamPixels(const uint16_t *pixels, uint32_t count);
+void ili9341_streamEnd(void);
+// count pixels of one color
+void ili9341_streamRun(uint16_t color, uint32_t count);
+// count RGB565 pixels stored as two bytes each, high byte first, so they need not be aligned
+void ili9341_streamPixelBytes(const uint8_t *bytes, uint32_t count);
+// Pixels that are sent often can be encoded once and given to the stream as words. 
+// count is in pixels for ili9341_encodePixels and in words for ili9341_streamWords.
+void ili9341_encodePixels(Ili9341PixelWord *words, const uint16_t *pixels, uint32_t count);
+void ili9341_streamWords(const Ili9341PixelWord *words, uint32_t count);
+// GRAM read back, for drawing over what is on the screen without a framebuffer. pixels is w*h values 
+// row by row, of which only those on the screen are read. Reading loses nothing of RGB565.
+void ili9341_readRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t *pixels);
+uint16_t ili9341_readPixel(int16_t x, int16_t y);
+// Changes pixels, the w*h pixels of the rectangle at x, y row by row, in place
+typedef void (*Ili9341BlendFunc)(void *user, uint16_t *pixels, int16_t x, int16_t y, int16_t w, int16_t h);
+// Reads the part of the rectangle on the screen in chunks of up to ILI9341_READ_CHUNK_PIXELS, 
+// hands every chunk to blend and writes it back
+void ili9341_blendRect(int16_t x, int16_t y, int16_t w, int16_t h, Ili9341BlendFunc blend, void *user);
+// Draws color over the rectangle, alpha 255 is opaque
+void ili9341_fillRectAlpha(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color, uint8_t alpha);
+#ifdef ILI9341_4WIRE
+// Send CASET, PASET and RAMWR for the window and leave D/C high for the pixels
+void ili9341_setWindow(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1);
+void ili9341_writeMemoryContinue(void);
+// RGB565 pixels, one 16-bit transfer each. Blocks until they are sent.
+void ili9341_writePixels(const uint16_t *pixels, uint32_t count);
+#endif
 #endif /* ILI9341_H_ */
\ No newline at end of file
@@ -0,0 +1,85 @@
+#include <sam.h>
+#include "ili9341.h"
+#include "ili9341_console.h"
+#include "ili9341_text.h"
+
+static const struct Ili9341Font *console_font;
+static uint16_t console_fg;
+static uint16_t console_bg;
+static uint16_t console_top; // First memory row of the console
+static uint16_t console_lines;
+static uint8_t console_columns;
+// Memory line shown at the top, and the number of lines written since the console was cleared
+static uint16_t console_first;
+static uint16_t console_used;
+
+static char line_text[ILI9341_TFTWIDTH + 1];
+
+void ili9341_consoleInit(uint16_t top_fixed, uint16_t bottom_fixed, const struct Ili9341Font *font, uint16_t fg, uint16_t bg) {
+	// There has to be room for at least one line of one character
+	if ((font == NULL) || (font->height == 0) || (font->width == 0) || (font->width > ILI9341_TFTWIDTH) || 
+		((uint32_t)top_fixed + bottom_fixed + font->height > ILI9341_TFTHEIGHT)) {
+		while(1);
+	}
+	console_font = font;
+	console_fg = fg;
+	console_bg = bg;
+	console_top = top_fixed;
+	console_lines = (ILI9341_TFTHEIGHT - top_fixed - bottom_fixed) / font->height;
+	console_columns = ILI9341_TFTWIDTH / font->width;
+	
+	uint16_t scroll_height = console_lines * font->height;
+	ili9341_setScrollArea(top_fixed, scroll_height, ILI9341_TFTHEIGHT - top_fixed - scroll_height);
+	ili9341_consoleClear();
+}
+
+void ili9341_consoleClear(void) {
+	console_first = 0;
+	console_used = 0;
+	ili9341_setScrollStart(console_top);
+	ili9341_fillRect(0, console_top, ILI9341_TFTWIDTH, console_lines * console_font->height, console_bg);
+}
+
+// Every line is padded with spaces to the full width, so it is one window that also clears what was there.
+// The columns right of the last character are never written after ili9341_consoleClear.
+static void newLine(const char *text, uint8_t length) {
+	uint16_t line;
+	if (console_used < console_lines) {
+		line = console_used++;
+	}
+	else {
+		// Reuse the line at the top. It moves to the bottom when the start of the scroll area moves past it.
+		line = console_first;
+		console_first = (console_first + 1) % console_lines;
+		ili9341_setScrollStart(console_top + console_first * console_font->height);
+	}
+	
+	for (uint8_t i = 0; i < console_columns; i++) {
+		line_text[i] = (i < length) ? text[i] : ' ';
+	}
+	line_text[console_columns] = '\0';
+	ili9341_drawText(0, console_top + line * console_font->height, line_text, console_font, console_fg, console_bg);
+}
+
+void ili9341_consolePrint(const char *text) {
+	const char *line_start = text;
+	uint8_t length = 0;
+	while (1) {
+		char character = line_start[length];
+		if ((character == '\0') || (character == '\n') || (length == console_columns)) {
+			newLine(line_start, length);
+			line_start += length;
+			if (character == '\n') {
+				line_start++;
+			}
+			// A '\n' at the end does not add an empty line
+			if (*line_start == '\0') {
+				break;
+			}
+			length = 0;
+		}
+		else {
+			length++;
+		}
+	}
+}
@@ -0,0 +1,22 @@
+#ifndef ILI9341_CONSOLE_H_
+#define ILI9341_CONSOLE_H_
+
+#include <stdint.h>
+#include "ili9341.h"
+#include "ili9341_text.h"
+
+// A scrolling text console for event logs. The console area is the scroll area of the panel, and holds 
+// one text line per font->height memory rows. When it is full, a new line is written over the oldest 
+// one and the panel is scrolled by one line with VSCRSADD, so a line costs one text row write 
+// however full the console is.
+// The rows above and below the console stay where they are, and can be drawn on as usual.
+
+// top_fixed and bottom_fixed are the rows kept above and below the console. Rows that are left 
+// over when the rest is divided into text lines are added to the bottom. The rows in between have to 
+// hold at least one line.
+void ili9341_consoleInit(uint16_t top_fixed, uint16_t bottom_fixed, const struct Ili9341Font *font, uint16_t fg, uint16_t bg);
+void ili9341_consoleClear(void);
+// Adds text at the bottom of the console. Every '\n' ends a line, and lines that are too long are wrapped.
+void ili9341_consolePrint(const char *text);
+
+#endif /* ILI9341_CONSOLE_H_ */
@@ -0,0 +1,111 @@
+#include <sam.h>
+#include "ili9341_convert.h"
+
+#include <string.h>
+
+// Half of the bits each channel of 0x00RRGGBB loses, added before they are cut off
+#define RGB_ROUNDING	0x00040204
+
+// Add the four bytes of b to those of a, each stopping at 0xFF
+static inline uint32_t addSaturated8(uint32_t a, uint32_t b) {
+#if defined(__ARM_FEATURE_DSP) && (__ARM_FEATURE_DSP == 1)
+	return __UQADD8(a, b);
+#else
+	// Add the low 7 bits of every byte so nothing carries into the next byte, then work out bit 7 and its carry
+	uint32_t sum = (a & 0x7F7F7F7F) + (b & 0x7F7F7F7F);
+	uint32_t carry = ((a & b) | ((a | b) & sum)) & 0x80808080;
+	uint32_t result = (sum & 0x7F7F7F7F) | ((sum ^ a ^ b) & 0x80808080);
+	return result | ((carry >> 7) * 0xFF);
+#endif
+}
+
+static inline uint16_t packRGB565(uint32_t rgb) {
+	rgb = addSaturated8(rgb, RGB_ROUNDING);
+	return ((rgb >> 8) & 0xF800) | ((rgb >> 5) & 0x07E0) | ((rgb >> 3) & 0x001F);
+}
+
+uint8_t ili9341_bytesPerPixel(enum Ili9341PixelFormat format) {
+	switch (format) {
+		case ILI9341_FORMAT_RGB888:
+		return 3;
+		case ILI9341_FORMAT_ARGB8888:
+		return 4;
+		case ILI9341_FORMAT_GRAY8:
+		return 1;
+		default:
+		return 2;
+	}
+}
+
+void ili9341_convert(uint16_t *out, const void *in, uint32_t count, enum Ili9341PixelFormat format) {
+	switch (format) {
+		case ILI9341_FORMAT_RGB888:
+		ili9341_convertRGB888(out, in, count);
+		break;
+		case ILI9341_FORMAT_ARGB8888:
+		ili9341_convertARGB8888(out, in, count);
+		break;
+		case ILI9341_FORMAT_GRAY8:
+		ili9341_convertGray8(out, in, count);
+		break;
+		default:
+		memcpy(out, in, count * sizeof(uint16_t));
+		break;
+	}
+}
+
+void ili9341_convertRGB888(uint16_t *out, const uint8_t *in, uint32_t count) {
+	for (uint32_t i = 0; i < count; i++) {
+		out[i] = packRGB565((in[0] << 16) | (in[1] << 8) | in[2]);
+		in += 3;
+	}
+}
+
+void ili9341_convertARGB8888(uint16_t *out, const uint32_t *in, uint32_t count) {
+	for (uint32_t i = 0; i < count; i++) {
+		out[i] = packRGB565(in[i]);
+	}
+}
+
+// Four grey values are rounded at once, to 5 bits for red and blue and to 6 bits for green
+void ili9341_convertGray8(uint16_t *out, const uint8_t *in, uint32_t count) {
+	uint32_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		uint32_t greys;
+		memcpy(&greys, &in[i], sizeof(greys));
+		uint32_t red_blue = addSaturated8(greys, 0x04040404);
+		uint32_t green = addSaturated8(greys, 0x02020202);
+		for (uint8_t j = 0; j < 4; j++) {
+			uint16_t level = (red_blue >> (8 * j + 3)) & 0x1F;
+			out[i + j] = (level << 11) | (((green >> (8 * j + 2)) & 0x3F) << 5) | level;
+		}
+	}
+	for (; i < count; i++) {
+		out[i] = packRGB565(in[i] * 0x010101);
+	}
+}
+
+// The channels are spread out to 0b00000GGGGGG00000RRRRR000000BBBBB so all three are blended with one multiply. 
+// Alpha is cut down to 0..32 so the products fit in the gaps between the channels.
+#define SPREAD_MASK	0x07E0F81F
+
+static inline uint32_t spread565(uint16_t color) {
+	return (color | ((uint32_t)color << 16)) & SPREAD_MASK;
+}
+
+static inline uint16_t blendSpread(uint32_t fg, uint32_t bg, uint32_t alpha) {
+	uint32_t result = ((((fg - bg) * alpha) >> 5) + bg) & SPREAD_MASK;
+	return (uint16_t)(result | (result >> 16));
+}
+
+uint16_t ili9341_blend565(uint16_t fg, uint16_t bg, uint8_t alpha) {
+	return blendSpread(spread565(fg), spread565(bg), (alpha + 4) >> 3);
+}
+
+void ili9341_blendColor(uint16_t *pixels, uint32_t count, uint16_t color, uint8_t alpha) {
+	uint32_t fg = spread565(color);
+	uint32_t scaled_alpha = (alpha + 4) >> 3;
+	for (uint32_t i = 0; i < count; i++) {
+		pixels[i] = blendSpread(fg, spread565(pixels[i]), scaled_alpha);
+	}
+}
@@ -0,0 +1,22 @@
+#ifndef ILI9341_CONVERT_H_
+#define ILI9341_CONVERT_H_
+
+#include <stdint.h>
+#include "ili9341.h"
+
+// Conversion of other pixel formats to the RGB565 the panel takes. Every channel is rounded
+// to the nearest value (255 stays 31 or 63). On a core with the DSP extension the rounding is
+// done for four bytes at once with UQADD8, otherwise with plain C that gives the same result.
+
+uint8_t ili9341_bytesPerPixel(enum Ili9341PixelFormat format);
+// count pixels from in, in the given format, to RGB565 in out
+void ili9341_convert(uint16_t *out, const void *in, uint32_t count, enum Ili9341PixelFormat format);
+void ili9341_convertRGB888(uint16_t *out, const uint8_t *in, uint32_t count);
+void ili9341_convertARGB8888(uint16_t *out, const uint32_t *in, uint32_t count);
+void ili9341_convertGray8(uint16_t *out, const uint8_t *in, uint32_t count);
+
+// Alpha blending in RGB565, alpha 255 gives fg and 0 gives bg
+uint16_t ili9341_blend565(uint16_t fg, uint16_t bg, uint8_t alpha);
+void ili9341_blendColor(uint16_t *pixels, uint32_t count, uint16_t color, uint8_t alpha);
+
+#endif /* ILI9341_CONVERT_H_ */
@@ -0,0 +1,66 @@
+#include <sam.h>
+#include "ili9341.h"
+#include "ili9341_image.h"
+
+// Packets are cut at the ends of the rows, and at the edges of the screen for an image that is not all on it
+bool ili9341_drawImage(int16_t x, int16_t y, const struct Ili9341Image *image) {
+	int16_t visible_x = x;
+	int16_t visible_y = y;
+	int16_t visible_w = image->width;
+	int16_t visible_h = image->height;
+	if (!ili9341_clipRect(&visible_x, &visible_y, &visible_w, &visible_h)) {
+		return true;
+	}
+	// The visible part in image coordinates
+	uint16_t first_column = visible_x - x;
+	uint16_t end_column = first_column + visible_w;
+	uint16_t first_row = visible_y - y;
+	uint16_t end_row = first_row + visible_h;
+
+	const uint8_t *data = image->data;
+	const uint8_t *end = data + image->length;
+	uint16_t column = 0;
+	uint16_t row = 0;
+	ili9341_streamBegin(visible_x, visible_y, visible_x+visible_w-1, visible_y+visible_h-1);
+	while (row < end_row) {
+		if (data >= end) {
+			break;
+		}
+		uint8_t header = *data++;
+		bool run = (header & ILI9341_IMAGE_RUN) != 0;
+		uint32_t count = (header & ~ILI9341_IMAGE_RUN) + 1;
+		const uint8_t *pixels = data;
+		data += run ? 2 : 2 * count;
+		if (data > end) {
+			break;
+		}
+		uint16_t color = (pixels[0] << 8) | pixels[1];
+
+		while ((count > 0) && (row < end_row)) {
+			uint16_t length = (count < (uint32_t)(image->width - column)) ? count : (image->width - column);
+			if (row >= first_row) {
+				uint16_t from = (column > first_column) ? column : first_column;
+				uint16_t to = (column + length < end_column) ? (column + length) : end_column;
+				if (from < to) {
+					if (run) {
+						ili9341_streamRun(color, to - from);
+					}
+					else {
+						ili9341_streamPixelBytes(&pixels[2 * (from - column)], to - from);
+					}
+				}
+			}
+			if (!run) {
+				pixels += 2 * length;
+			}
+			count -= length;
+			column += length;
+			if (column == image->width) {
+				column = 0;
+				row++;
+			}
+		}
+	}
+	ili9341_streamEnd();
+	return row >= end_row;
+}
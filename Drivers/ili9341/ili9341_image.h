@@ -0,0 +1,37 @@
+#ifndef ILI9341_IMAGE_H_
+#define ILI9341_IMAGE_H_
+
+#include <stdint.h>
+#include "ili9341.h"
+
+// Run length compressed RGB565 images, for splash screens and icons in flash. ili9341_drawImage decodes
+// straight into the PDC buffers of the pixel stream, so a piece is decoded while the one before is sent
+// and the image is never copied through RAM.
+//
+// The data is a list of packets covering the pixels row by row. Packets may go on into the next row.
+// Each packet starts with a byte n:
+//   n & 0x80 set:   a run of (n & 0x7F) + 1 pixels of the color in the next two bytes
+//   n & 0x80 clear: n + 1 pixels that follow as two bytes each
+// Colors are RGB565 with the high byte first, as the panel takes them.
+//
+// Tools/ili9341_imageconv.c converts PPM files into C sources with one struct Ili9341Image each. Tests/Makefile
+// builds it and converts Tests/images/splash.ppm, a 120x90 dashboard that packs into 2681 bytes instead of
+// 21600. Tests/bench_ili9341_image finds drawing it as fast as a writeRect from RAM: both are bus bound, at
+// 7.8 ms for its 21692 words at 25 MHz in 3-wire mode.
+
+#define ILI9341_IMAGE_RUN	0x80
+// Most pixels in one packet
+#define ILI9341_IMAGE_MAX_COUNT	128
+
+struct Ili9341Image {
+	uint16_t width;
+	uint16_t height;
+	const uint8_t *data;
+	/* In bytes */
+	uint32_t length;
+};
+
+// Only the part on the screen is sent. Returns false if the data ends before the last pixel.
+bool ili9341_drawImage(int16_t x, int16_t y, const struct Ili9341Image *image);
+
+#endif /* ILI9341_IMAGE_H_ */
@@ -0,0 +1,223 @@
+#include <sam.h>
+#include "ili9341.h"
+
+#ifndef ILI9341_4WIRE
+
+#include "ili9341_list.h"
+#include "ili9341_tear.h"
+#include "ili9341_regs.h"
+#include "ili9341_pioInterface.h"
+
+#include "../spi.h"
+
+// Where a list was before a primitive, so a primitive that does not fit can be taken back out
+struct ListMark {
+	uint32_t word_count;
+	uint16_t segment_count;
+	uint32_t last_length;
+};
+
+static struct ListMark markList(const struct Ili9341DisplayList *list) {
+	struct ListMark mark = {list->word_count, list->segment_count, 0};
+	if (list->segment_count > 0) {
+		mark.last_length = list->segments[list->segment_count - 1].length;
+	}
+	return mark;
+}
+
+static void rewindList(struct Ili9341DisplayList *list, struct ListMark mark) {
+	list->word_count = mark.word_count;
+	list->segment_count = mark.segment_count;
+	if (mark.segment_count > 0) {
+		list->segments[mark.segment_count - 1].length = mark.last_length;
+	}
+}
+
+static bool hasRoom(const struct Ili9341DisplayList *list, uint32_t words, uint16_t segments) {
+	return (list->word_count + words <= list->word_capacity) &&
+		(list->segment_count + segments <= list->segment_capacity);
+}
+
+// Send length words starting at words[start], repeat times. Words that follow on from the last
+// segment just make it longer, so a run of small primitives stays one segment.
+static void addSegment(struct Ili9341DisplayList *list, uint32_t start, uint32_t length, uint32_t repeat) {
+	if ((list->segment_count > 0) && (repeat == 0)) {
+		struct SpiSegment *last = &list->segments[list->segment_count - 1];
+		if ((last->repeat == 0) && ((uint32_t *)last->transmit_buffer + last->length == &list->words[start])) {
+			last->length += length;
+			return;
+		}
+	}
+	struct SpiSegment *segment = &list->segments[list->segment_count++];
+	segment->transmit_buffer = &list->words[start];
+	segment->receive_buffer = NULL;
+	segment->length = length;
+	segment->repeat = repeat;
+}
+
+void ili9341_listInit(struct Ili9341DisplayList *list, uint32_t *words, uint32_t word_capacity, struct SpiSegment *segments, uint16_t segment_capacity) {
+	list->words = words;
+	list->word_capacity = word_capacity;
+	list->word_count = 0;
+	list->segments = segments;
+	list->segment_capacity = segment_capacity;
+	list->segment_count = 0;
+	list->in_flight = false;
+}
+
+void ili9341_listClear(struct Ili9341DisplayList *list) {
+	ili9341_listWait(list);
+	list->word_count = 0;
+	list->segment_count = 0;
+}
+
+bool ili9341_listPixel(struct Ili9341DisplayList *list, int16_t x, int16_t y, uint16_t color) {
+	return ili9341_listFillRect(list, x, y, 1, 1, color);
+}
+
+// Up to ILI9341_LIST_FILL_PIXELS pixels go in behind the window. A larger fill sends those
+// pixels again as a repeated segment, and the rest from the start of the same block.
+bool ili9341_listFillRect(struct Ili9341DisplayList *list, int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) {
+	if (!ili9341_clipRect(&x, &y, &w, &h)) {
+		return true;
+	}
+	uint32_t pixels = (uint32_t)w * h;
+	uint32_t block_pixels = (pixels < ILI9341_LIST_FILL_PIXELS) ? pixels : ILI9341_LIST_FILL_PIXELS;
+	if (!hasRoom(list, ILI9341_WINDOW_WORDS + 2 * block_pixels, 3)) {
+		return false;
+	}
+
+	uint32_t start = list->word_count;
+	uint32_t index = start + ili9341_encodeWindow(&list->words[start], x, y, x+w-1, y+h-1);
+	uint32_t block = index;
+	uint32_t color_high = spi_word(false,ILI9341_CHIP_SELECT, (DATA_BIT | (color >> 8)));
+	uint32_t color_low = spi_word(false,ILI9341_CHIP_SELECT, (DATA_BIT | (color & 0xFF)));
+	for (uint32_t i = 0; i < block_pixels; i++) {
+		list->words[index++] = color_high;
+		list->words[index++] = color_low;
+	}
+	list->word_count = index;
+	addSegment(list, start, index - start, 0);
+
+	pixels -= block_pixels;
+	if (pixels >= block_pixels) {
+		addSegment(list, block, 2 * block_pixels, pixels / block_pixels);
+		pixels %= block_pixels;
+	}
+	if (pixels > 0) {
+		addSegment(list, block, 2 * pixels, 0);
+	}
+	return true;
+}
+
+bool ili9341_listRect(struct Ili9341DisplayList *list, int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) {
+	if ((w <= 0) || (h <= 0)) {
+		return true;
+	}
+	struct ListMark mark = markList(list);
+	bool fits = ili9341_listFillRect(list, x, y, w, 1, color);
+	if (fits && (h > 1)) {
+		fits = ili9341_listFillRect(list, x, y+h-1, w, 1, color);
+	}
+	if (fits && (h > 2)) {
+		fits = ili9341_listFillRect(list, x, y+1, 1, h-2, color);
+		if (fits && (w > 1)) {
+			fits = ili9341_listFillRect(list, x+w-1, y+1, 1, h-2, color);
+		}
+	}
+	if (!fits) {
+		rewindList(list, mark);
+	}
+	return fits;
+}
+
+struct LineRecording {
+	struct Ili9341DisplayList *list;
+	uint16_t color;
+};
+
+static bool recordRun(void *user, int16_t x, int16_t y, int16_t w, int16_t h) {
+	struct LineRecording *recording = user;
+	return ili9341_listFillRect(recording->list, x, y, w, h, recording->color);
+}
+
+bool ili9341_listLine(struct Ili9341DisplayList *list, int16_t x0, int16_t y0, int16_t x1, int16_t y1, uint16_t color) {
+	struct ListMark mark = markList(list);
+	struct LineRecording recording = {list, color};
+	if (!ili9341_lineRuns(x0, y0, x1, y1, recordRun, &recording)) {
+		rewindList(list, mark);
+		return false;
+	}
+	return true;
+}
+
+bool ili9341_listGlyph(struct Ili9341DisplayList *list, int16_t x, int16_t y, const uint8_t *bitmap, uint8_t w, uint8_t h, uint16_t fg, uint16_t bg) {
+	int16_t visible_x = x;
+	int16_t visible_y = y;
+	int16_t visible_w = w;
+	int16_t visible_h = h;
+	if (!ili9341_clipRect(&visible_x, &visible_y, &visible_w, &visible_h)) {
+		return true;
+	}
+	if (!hasRoom(list, ILI9341_WINDOW_WORDS + 2 * (uint32_t)visible_w * visible_h, 1)) {
+		return false;
+	}
+
+	uint32_t start = list->word_count;
+	uint32_t index = start + ili9341_encodeWindow(&list->words[start], visible_x, visible_y, visible_x+visible_w-1, visible_y+visible_h-1);
+	uint32_t data_word = spi_word(false,ILI9341_CHIP_SELECT, DATA_BIT);
+	uint8_t row_bytes = (w + 7) / 8;
+	for (int16_t row = visible_y - y; row < visible_y - y + visible_h; row++) {
+		const uint8_t *bits = &bitmap[row * row_bytes];
+		for (int16_t column = visible_x - x; column < visible_x - x + visible_w; column++) {
+			uint16_t color = (bits[column / 8] & (0x80 >> (column % 8))) ? fg : bg;
+			list->words[index++] = data_word | (color >> 8);
+			list->words[index++] = data_word | (color & 0xFF);
+		}
+	}
+	list->word_count = index;
+	addSegment(list, start, index - start, 0);
+	return true;
+}
+
+static void prepareFlush(struct Ili9341DisplayList *list) {
+	list->transfer = (struct SpiTransfer){
+		.segments = list->segments,
+		.segment_count = list->segment_count,
+		.format = SPI_FORMAT_PDC_WORD,
+		.chip_select = ILI9341_CHIP_SELECT,
+		.callBackFunc = NULL,
+		.user = NULL,
+		.notify_task = xTaskGetCurrentTaskHandle()
+	};
+}
+
+void ili9341_listFlush(struct Ili9341DisplayList *list) {
+	if (list->segment_count == 0) {
+		return;
+	}
+	prepareFlush(list);
+	list->in_flight = true;
+	spi_submitTransfer(&list->transfer);
+}
+
+bool ili9341_listFlushOnTear(struct Ili9341DisplayList *list) {
+	if (list->segment_count == 0) {
+		return true;
+	}
+	prepareFlush(list);
+	if (!ili9341_submitOnTear(&list->transfer)) {
+		return false;
+	}
+	list->in_flight = true;
+	return true;
+}
+
+void ili9341_listWait(struct Ili9341DisplayList *list) {
+	if (list->in_flight) {
+		spi_waitForTransfer(&list->transfer);
+		list->in_flight = false;
+	}
+}
+
+#endif
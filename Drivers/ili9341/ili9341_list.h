@@ -0,0 +1,63 @@
+#ifndef ILI9341_LIST_H_
+#define ILI9341_LIST_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ili9341.h"
+#include "../spi.h"
+
+// A display list records drawing into a buffer of SPI words instead of sending each primitive
+// on its own. ili9341_listFlush then gives the whole list to the SPI driver as one scatter-gather
+// transfer, so a frame of UI is a single transfer to the display and does not block the task.
+// With two lists, the next frame can be recorded while the previous one is still being sent.
+//
+// Every primitive is encoded when it is recorded: its window, RAMWR and pixels are appended to
+// the word buffer. Fills larger than ILI9341_LIST_FILL_PIXELS store one block of pixels and send
+// it repeatedly, so a fill costs the same buffer space whatever its size.
+//
+// A list can only be used in 3-wire mode, since in 4-wire mode the D/C pin would have to change
+// in the middle of the transfer.
+#ifdef ILI9341_4WIRE
+#error "Display lists need the 3-wire interface"
+#endif
+
+// Pixels stored for a fill that is sent as a repeated block
+#define ILI9341_LIST_FILL_PIXELS	64
+
+struct Ili9341DisplayList {
+	uint32_t *words;
+	uint32_t word_capacity;
+	uint32_t word_count;
+	struct SpiSegment *segments;
+	uint16_t segment_capacity;
+	uint16_t segment_count;
+
+	/* Used by the driver */
+	struct SpiTransfer transfer;
+	bool in_flight;
+};
+
+// words and segments are owned by the list until it is dropped, and must stay valid while it is in flight
+void ili9341_listInit(struct Ili9341DisplayList *list, uint32_t *words, uint32_t word_capacity, struct SpiSegment *segments, uint16_t segment_capacity);
+// Waits for the list if it is in flight, and empties it for recording
+void ili9341_listClear(struct Ili9341DisplayList *list);
+
+// Recording returns false and leaves the list as it was if the primitive does not fit.
+// Nothing may be recorded into a list that is in flight.
+bool ili9341_listPixel(struct Ili9341DisplayList *list, int16_t x, int16_t y, uint16_t color);
+bool ili9341_listFillRect(struct Ili9341DisplayList *list, int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color);
+bool ili9341_listRect(struct Ili9341DisplayList *list, int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color);
+bool ili9341_listLine(struct Ili9341DisplayList *list, int16_t x0, int16_t y0, int16_t x1, int16_t y1, uint16_t color);
+// A 1 bit per pixel bitmap, rows of (w+7)/8 bytes with the leftmost pixel in the MSB. Set pixels are drawn
+// in fg and clear pixels in bg.
+bool ili9341_listGlyph(struct Ili9341DisplayList *list, int16_t x, int16_t y, const uint8_t *bitmap, uint8_t w, uint8_t h, uint16_t fg, uint16_t bg);
+
+// Start sending the list and return. The list is in flight until ili9341_listWait, which must be
+// called from the same task.
+void ili9341_listFlush(struct Ili9341DisplayList *list);
+// Like ili9341_listFlush, but the list is sent from the next TE edge (see ili9341_tear.h).
+// Returns false, and the list is not in flight, if the TE queue is full.
+bool ili9341_listFlushOnTear(struct Ili9341DisplayList *list);
+void ili9341_listWait(struct Ili9341DisplayList *list);
+
+#endif /* ILI9341_LIST_H_ */
@@ -11,6 +11,19 @@
 #define ILI9341_DATA_OR_CMD_PIO PIOA
 #define ILI9341_DATA_OR_CMD_PIN 22
 
+// Tearing effect output of the panel, for ili9341_tearInit
+#define ILI9341_TE_PIO	PIOA
+#define ILI9341_TE_PIN	23
+#define ILI9341_TE_IRQn	PIOA_IRQn
+
+// Define when the display is wired for the 4-wire serial interface, where the D/C pin above tells 
+// commands from data. The chip select must then be set up with 8 bits per transfer, and pixels go out 
+// as one 16-bit transfer each. Without it the 3-wire interface is used, where every byte carries its 
+// D/C bit as a 9th bit (DATA_BIT) and the chip select has 9 bits per transfer.
+// D/C may only change with the bus idle, so commands and their parameters are sent with 
+// spi_freeRTOSTranceiveSequence, which polls short sequences without letting go of the bus.
+//#define ILI9341_4WIRE
+
 
 
 #endif /* ILI9341_PIOINTERFACE_H_ */
\ No newline at end of file
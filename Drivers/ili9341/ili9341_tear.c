@@ -0,0 +1,124 @@
+#include <sam.h>
+#include "ili9341.h"
+#include "ili9341_tear.h"
+#include "ili9341_pioInterface.h"
+
+#include "../pio.h"
+#include "../spi.h"
+
+static struct SpiTransfer *tear_queue[ILI9341_TEAR_QUEUE_LENGTH];
+static uint8_t tear_queued = 0;
+// Transfers started at the last edge, to tell at the next edge if they were done in time
+static struct SpiTransfer *tear_started[ILI9341_TEAR_QUEUE_LENGTH];
+static uint8_t tear_started_count = 0;
+
+static TaskHandle_t tear_waiting_task = NULL;
+static volatile bool tear_frame_open = false;
+static volatile uint32_t tear_edges = 0;
+static uint32_t tear_last_edge;
+static struct Ili9341FrameStatistics frame_statistics;
+
+static void tearHandler(void) {
+	uint32_t now = DWT->CYCCNT;
+	if (frame_statistics.refreshes > 0) {
+		frame_statistics.refresh_cycles = now - tear_last_edge;
+	}
+	tear_last_edge = now;
+	frame_statistics.refreshes++;
+
+	// A frame drawn by a task is only counted once, however many edges it takes
+	bool late = tear_frame_open;
+	tear_frame_open = false;
+	for (uint8_t i = 0; i < tear_started_count; i++) {
+		if (!spi_transferIsDone(tear_started[i])) {
+			late = true;
+		}
+	}
+	if (late) {
+		frame_statistics.late_frames++;
+	}
+
+	BaseType_t higher_priority_task_woken = pdFALSE;
+	bool frame = false;
+	tear_started_count = 0;
+	for (uint8_t i = 0; i < tear_queued; i++) {
+		tear_started[tear_started_count++] = tear_queue[i];
+		spi_submitTransferFromISR(tear_queue[i]);
+		frame = true;
+	}
+	tear_queued = 0;
+	tear_edges++;
+	if (tear_waiting_task != NULL) {
+		tear_frame_open = true;
+		vTaskNotifyGiveFromISR(tear_waiting_task, &higher_priority_task_woken);
+		tear_waiting_task = NULL;
+		frame = true;
+	}
+	if (frame) {
+		frame_statistics.frames++;
+	}
+	portEND_SWITCHING_ISR(higher_priority_task_woken);
+}
+
+void ili9341_tearInit(uint8_t NVIC_pio_interrupt_priority, uint16_t scanline) {
+	pio_setMux(ILI9341_TE_PIO, ILI9341_TE_PIN, PIO);
+	pio_disableOutput(ILI9341_TE_PIO, ILI9341_TE_PIN);
+	NVIC_SetPriority(ILI9341_TE_IRQn, NVIC_pio_interrupt_priority);
+	ili9341_setTearingEffect(true, scanline);
+	pio_enableInterrupt(ILI9341_TE_PIO, ILI9341_TE_PIN, RISING_EDGE, tearHandler);
+}
+
+void ili9341_tearDisable(void) {
+	pio_disableInterrupt(ILI9341_TE_PIO, ILI9341_TE_PIN);
+	ili9341_setTearingEffect(false, 0);
+	taskENTER_CRITICAL();
+	for (uint8_t i = 0; i < tear_queued; i++) {
+		spi_submitTransfer(tear_queue[i]);
+	}
+	tear_queued = 0;
+	tear_started_count = 0;
+	tear_frame_open = false;
+	taskEXIT_CRITICAL();
+}
+
+// The notification value is shared with the SPI driver, so the wait only ends once the edge count has moved on
+void ili9341_beginFrame(void) {
+	taskENTER_CRITICAL();
+	uint32_t edge = tear_edges;
+	tear_frame_open = false;
+	tear_waiting_task = xTaskGetCurrentTaskHandle();
+	taskEXIT_CRITICAL();
+	while (tear_edges == edge) {
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+	}
+}
+
+void ili9341_endFrame(void) {
+	tear_frame_open = false;
+}
+
+bool ili9341_submitOnTear(struct SpiTransfer *transfer) {
+	bool queued = false;
+	taskENTER_CRITICAL();
+	if (tear_queued < ILI9341_TEAR_QUEUE_LENGTH) {
+		// A descriptor is only reused once it is done, so it no longer counts towards the last frame
+		for (uint8_t i = 0; i < tear_started_count; i++) {
+			if (tear_started[i] == transfer) {
+				tear_started[i] = tear_started[--tear_started_count];
+				break;
+			}
+		}
+		// Pending from now on, so spi_waitForTransfer also waits for the edge
+		transfer->status = SPI_TRANSFER_PENDING;
+		tear_queue[tear_queued++] = transfer;
+		queued = true;
+	}
+	taskEXIT_CRITICAL();
+	return queued;
+}
+
+void ili9341_getFrameStatistics(struct Ili9341FrameStatistics *statistics) {
+	taskENTER_CRITICAL();
+	*statistics = frame_statistics;
+	taskEXIT_CRITICAL();
+}
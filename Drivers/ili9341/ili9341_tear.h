@@ -0,0 +1,48 @@
+#ifndef ILI9341_TEAR_H_
+#define ILI9341_TEAR_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ili9341.h"
+#include "../spi.h"
+
+// Frame pacing on the tearing effect (TE) output of the panel. The panel raises TE once per refresh,
+// when it starts on the scanline set with ili9341_tearInit (0 is the start of vertical blanking). A 
+// frame started right behind that line stays ahead of the refresh while it is written, so it shows 
+// without tearing as long as it is written faster than the panel refreshes (about 14 ms at 70 Hz).
+//
+// A frame is either drawn by a task between ili9341_beginFrame and ili9341_endFrame, or queued with 
+// ili9341_submitOnTear and started by the TE interrupt. A frame that is still being sent at the next
+// TE edge counts as late.
+
+// Transfers that can wait for the next TE edge at the same time
+#define ILI9341_TEAR_QUEUE_LENGTH	4
+
+struct Ili9341FrameStatistics {
+	/* TE edges, one per refresh of the panel */
+	uint32_t refreshes;
+	/* CPU cycles between the last two TE edges */
+	uint32_t refresh_cycles;
+	/* Frames started on a TE edge */
+	uint32_t frames;
+	/* TE edges that came while the frame started on the edge before was still being sent */
+	uint32_t late_frames;
+};
+
+// Turns TE on and takes its rising edge as an interrupt. The priority is that of the whole PIO 
+// controller of ILI9341_TE_PIN and must allow FreeRTOS calls (>= 5, like the SPI interrupt).
+void ili9341_tearInit(uint8_t NVIC_pio_interrupt_priority, uint16_t scanline);
+// Turns TE off. Queued transfers are started at once.
+void ili9341_tearDisable(void);
+
+// Blocks until the next TE edge. The task then draws the frame and calls ili9341_endFrame once it is sent.
+void ili9341_beginFrame(void);
+void ili9341_endFrame(void);
+
+// The transfer is submitted from the TE interrupt at the next edge. It must stay valid until it is done.
+// Returns false if the queue is full.
+bool ili9341_submitOnTear(struct SpiTransfer *transfer);
+
+void ili9341_getFrameStatistics(struct Ili9341FrameStatistics *statistics);
+
+#endif /* ILI9341_TEAR_H_ */
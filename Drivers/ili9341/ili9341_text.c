@@ -0,0 +1,144 @@
+#include <sam.h>
+#include "ili9341.h"
+#include "ili9341_text.h"
+
+#include <string.h>
+
+struct GlyphEntry {
+	const struct Ili9341Font *font;
+	uint8_t glyph;
+	uint16_t fg;
+	uint16_t bg;
+	// Number of the last line that used the entry. Entries used by the line being drawn are not replaced.
+	uint32_t line;
+	Ili9341PixelWord words[ILI9341_GLYPH_MAX_PIXELS * ILI9341_WORDS_PER_PIXEL];
+};
+
+#if ILI9341_GLYPH_CACHE_ENTRIES > 0
+static struct GlyphEntry glyph_cache[ILI9341_GLYPH_CACHE_ENTRIES];
+#endif
+static bool glyph_cache_enabled = true;
+static uint32_t text_line = 0;
+static struct Ili9341GlyphCacheStatistics glyph_statistics;
+
+// Glyphs of the visible characters of the line being drawn, NULL for those drawn from the bitmap
+static struct GlyphEntry *line_glyphs[ILI9341_TFTWIDTH];
+static uint16_t row_pixels[ILI9341_TFTWIDTH];
+
+static uint8_t glyphIndex(const struct Ili9341Font *font, char character) {
+	uint8_t code = (uint8_t)character;
+	if ((code < font->first) || (code - font->first >= font->count)) {
+		return 0;
+	}
+	return code - font->first;
+}
+
+// Pixels of columns first_column to end_column-1 of one row of a glyph
+static void glyphRow(uint16_t *pixels, const struct Ili9341Font *font, uint8_t glyph, uint8_t row, uint8_t first_column, uint8_t end_column, uint16_t fg, uint16_t bg) {
+	uint8_t row_bytes = (font->width + 7) / 8;
+	const uint8_t *bits = &font->bitmap[((uint32_t)glyph * font->height + row) * row_bytes];
+	for (uint8_t column = first_column; column < end_column; column++) {
+		*pixels++ = (bits[column / 8] & (0x80 >> (column % 8))) ? fg : bg;
+	}
+}
+
+// The cache entry of the glyph. A glyph that is not cached yet replaces the least recently used entry. 
+// NULL if the glyph is too big for the cache, every entry is in use by this line, or the cache is off.
+static struct GlyphEntry *findGlyph(const struct Ili9341Font *font, uint8_t glyph, uint16_t fg, uint16_t bg) {
+#if ILI9341_GLYPH_CACHE_ENTRIES > 0
+	if (!glyph_cache_enabled || ((uint16_t)font->width * font->height > ILI9341_GLYPH_MAX_PIXELS)) {
+		glyph_statistics.uncached++;
+		return NULL;
+	}
+	struct GlyphEntry *oldest = &glyph_cache[0];
+	for (uint8_t i = 0; i < ILI9341_GLYPH_CACHE_ENTRIES; i++) {
+		struct GlyphEntry *entry = &glyph_cache[i];
+		if ((entry->font == font) && (entry->glyph == glyph) && (entry->fg == fg) && (entry->bg == bg)) {
+			entry->line = text_line;
+			glyph_statistics.hits++;
+			return entry;
+		}
+		if (entry->line < oldest->line) {
+			oldest = entry;
+		}
+	}
+	if ((oldest->font != NULL) && (oldest->line == text_line)) {
+		glyph_statistics.uncached++;
+		return NULL;
+	}
+
+	glyph_statistics.misses++;
+	oldest->font = font;
+	oldest->glyph = glyph;
+	oldest->fg = fg;
+	oldest->bg = bg;
+	oldest->line = text_line;
+	for (uint8_t row = 0; row < font->height; row++) {
+		glyphRow(row_pixels, font, glyph, row, 0, font->width, fg, bg);
+		ili9341_encodePixels(&oldest->words[(uint32_t)row * font->width * ILI9341_WORDS_PER_PIXEL], row_pixels, font->width);
+	}
+	return oldest;
+#else
+	glyph_statistics.uncached++;
+	return NULL;
+#endif
+}
+
+// The window covers the whole line, so its rows are put together from one row of every glyph.
+// The glyphs are looked up once before the first row, and hold their cache entries until the line is done.
+int16_t ili9341_drawText(int16_t x, int16_t y, const char *text, const struct Ili9341Font *font, uint16_t fg, uint16_t bg) {
+	uint16_t length = strlen(text);
+	int16_t end_x = x + length * font->width;
+	int16_t visible_x = x;
+	int16_t visible_y = y;
+	int16_t visible_w = length * font->width;
+	int16_t visible_h = font->height;
+	if (!ili9341_clipRect(&visible_x, &visible_y, &visible_w, &visible_h)) {
+		return end_x;
+	}
+	uint16_t first_character = (visible_x - x) / font->width;
+	uint16_t end_character = (visible_x + visible_w - 1 - x) / font->width + 1;
+
+	text_line++;
+	for (uint16_t i = first_character; i < end_character; i++) {
+		line_glyphs[i - first_character] = findGlyph(font, glyphIndex(font, text[i]), fg, bg);
+	}
+
+	ili9341_streamBegin(visible_x, visible_y, visible_x+visible_w-1, visible_y+visible_h-1);
+	for (uint8_t row = visible_y - y; row < visible_y - y + visible_h; row++) {
+		for (uint16_t i = first_character; i < end_character; i++) {
+			int16_t character_x = x + i * font->width;
+			uint8_t first_column = (character_x < visible_x) ? (visible_x - character_x) : 0;
+			uint8_t end_column = font->width;
+			if (character_x + font->width > visible_x + visible_w) {
+				end_column = visible_x + visible_w - character_x;
+			}
+			struct GlyphEntry *entry = line_glyphs[i - first_character];
+			if (entry != NULL) {
+				ili9341_streamWords(&entry->words[((uint32_t)row * font->width + first_column) * ILI9341_WORDS_PER_PIXEL],
+					(end_column - first_column) * ILI9341_WORDS_PER_PIXEL);
+			}
+			else {
+				glyphRow(row_pixels, font, glyphIndex(font, text[i]), row, first_column, end_column, fg, bg);
+				ili9341_streamPixels(row_pixels, end_column - first_column);
+			}
+		}
+	}
+	ili9341_streamEnd();
+	return end_x;
+}
+
+void ili9341_clearGlyphCache(void) {
+#if ILI9341_GLYPH_CACHE_ENTRIES > 0
+	memset(glyph_cache, 0, sizeof(glyph_cache));
+#endif
+	text_line = 0;
+}
+
+void ili9341_setGlyphCacheEnabled(bool enabled) {
+	glyph_cache_enabled = enabled;
+}
+
+void ili9341_getGlyphCacheStatistics(struct Ili9341GlyphCacheStatistics *statistics) {
+	*statistics = glyph_statistics;
+}
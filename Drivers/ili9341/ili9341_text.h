@@ -0,0 +1,52 @@
+#ifndef ILI9341_TEXT_H_
+#define ILI9341_TEXT_H_
+
+#include <stdint.h>
+#include "ili9341.h"
+
+// Text is drawn a line at a time behind one window. Every glyph cell is kept in a small cache already
+// encoded for the bus, for the colors it was drawn in, so drawing a glyph that is in the cache only
+// copies words into the PDC buffers. Glyphs that do not fit in the cache are drawn from the font bitmap.
+// The cache saves CPU time and not bus time: Tests/bench_ili9341_text draws 6x8 text at 28.7k characters 
+// per second at 25 MHz in 3-wire mode (30.9k in 4-wire mode) with or without it, close to the 28.9k the 
+// 864 clocks of a 3-wire cell allow. An entry takes 400 bytes of RAM in 3-wire mode and 112 in 4-wire
+// mode, so the cache is small unless ILI9341_GLYPH_CACHE_ENTRIES is set by the build, and 0 leaves it out.
+// Whether it pays for its RAM depends on the CPU time the application needs while text is drawn; measure
+// that on the target, with ili9341_setGlyphCacheEnabled to compare.
+
+/* A fixed width bitmap font */
+struct Ili9341Font {
+	/* One glyph after the other, each height rows of (width+7)/8 bytes with the leftmost pixel in the MSB. 
+	A glyph fills its whole cell, including the space to the next character and line. */
+	const uint8_t *bitmap;
+	uint8_t width;
+	uint8_t height;
+	/* Character of the first glyph, and the number of glyphs. Other characters are drawn as the first glyph. */
+	uint8_t first;
+	uint8_t count;
+};
+
+/* ASCII 32 to 126 in 6x8 cells */
+extern const struct Ili9341Font ili9341_font6x8;
+
+#ifndef ILI9341_GLYPH_CACHE_ENTRIES
+#define ILI9341_GLYPH_CACHE_ENTRIES	8
+#endif
+// Largest glyph cell that is cached, the cells of ili9341_font6x8
+#define ILI9341_GLYPH_MAX_PIXELS	48
+
+struct Ili9341GlyphCacheStatistics {
+	uint32_t hits;
+	uint32_t misses;
+	/* Glyphs drawn from the bitmap because every entry was taken by the same line, or the cache is off */
+	uint32_t uncached;
+};
+
+// Draws text on one line with its top left corner at x,y. Returns the x after the text.
+int16_t ili9341_drawText(int16_t x, int16_t y, const char *text, const struct Ili9341Font *font, uint16_t fg, uint16_t bg);
+void ili9341_clearGlyphCache(void);
+// While disabled every glyph is drawn from the bitmap and counted as uncached. The cache is enabled after reset.
+void ili9341_setGlyphCacheEnabled(bool enabled);
+void ili9341_getGlyphCacheStatistics(struct Ili9341GlyphCacheStatistics *statistics);
+
+#endif /* ILI9341_TEXT_H_ */
@@ -0,0 +1,92 @@
+#include <sam.h>
+#include "ili9341.h"
+#include "ili9341_tiles.h"
+#include "ili9341_regs.h"
+#include "ili9341_pioInterface.h"
+
+#include "../spi.h"
+
+// One bit per tile column, one word per tile row
+static uint16_t dirty_tiles[ILI9341_TILE_ROWS];
+
+static uint16_t strip[ILI9341_STRIP_PIXELS];
+
+void ili9341_invalidate(int16_t x, int16_t y, int16_t w, int16_t h) {
+	if (x < 0) {
+		w += x;
+		x = 0;
+	}
+	if (y < 0) {
+		h += y;
+		y = 0;
+	}
+	if ((w <= 0) || (h <= 0) || (x >= ILI9341_TFTWIDTH) || (y >= ILI9341_TFTHEIGHT)) {
+		return;
+	}
+	int16_t last_column = (x + w - 1) / ILI9341_TILE_SIZE;
+	int16_t last_row = (y + h - 1) / ILI9341_TILE_SIZE;
+	if (last_column >= ILI9341_TILE_COLUMNS) {
+		last_column = ILI9341_TILE_COLUMNS - 1;
+	}
+	if (last_row >= ILI9341_TILE_ROWS) {
+		last_row = ILI9341_TILE_ROWS - 1;
+	}
+	uint16_t columns = ((1 << (last_column + 1)) - 1) & ~((1 << (x / ILI9341_TILE_SIZE)) - 1);
+	for (int16_t row = y / ILI9341_TILE_SIZE; row <= last_row; row++) {
+		dirty_tiles[row] |= columns;
+	}
+}
+
+void ili9341_invalidateScreen(void) {
+	ili9341_invalidate(0, 0, ILI9341_TFTWIDTH, ILI9341_TFTHEIGHT);
+}
+
+bool ili9341_isDirty(void) {
+	for (uint8_t row = 0; row < ILI9341_TILE_ROWS; row++) {
+		if (dirty_tiles[row] != 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Render a rectangle band by band and stream it behind one window
+static void flushRect(int16_t x, int16_t y, int16_t w, int16_t h, Ili9341RenderFunc render, void *user) {
+	int16_t band_height = ILI9341_STRIP_PIXELS / w;
+	ili9341_streamBegin(x, y, x+w-1, y+h-1);
+	for (int16_t band_y = y; band_y < y + h; band_y += band_height) {
+		int16_t rows = (y + h - band_y < band_height) ? (y + h - band_y) : band_height;
+		// The pieces in flight were copied from the strip already, so it can be drawn over
+		render(strip, x, band_y, w, rows, user);
+		ili9341_streamPixels(strip, (uint32_t)w * rows);
+	}
+}
+
+// Greedy merge: take the first run of dirty tiles in a row and grow it downwards 
+// as long as the rows below are dirty over the whole run
+uint16_t ili9341_flushDirty(Ili9341RenderFunc render, void *user) {
+	uint16_t rectangles = 0;
+	for (uint8_t row = 0; row < ILI9341_TILE_ROWS; row++) {
+		while (dirty_tiles[row] != 0) {
+			uint8_t first_column = 0;
+			while (!(dirty_tiles[row] & (1 << first_column))) {
+				first_column++;
+			}
+			uint8_t end_column = first_column;
+			while ((end_column < ILI9341_TILE_COLUMNS) && (dirty_tiles[row] & (1 << end_column))) {
+				end_column++;
+			}
+			uint16_t run = ((1 << end_column) - 1) & ~((1 << first_column) - 1);
+			uint8_t end_row = row;
+			while ((end_row < ILI9341_TILE_ROWS) && ((dirty_tiles[end_row] & run) == run)) {
+				dirty_tiles[end_row] &= ~run;
+				end_row++;
+			}
+			flushRect(first_column * ILI9341_TILE_SIZE, row * ILI9341_TILE_SIZE, 
+				(end_column - first_column) * ILI9341_TILE_SIZE, (end_row - row) * ILI9341_TILE_SIZE, render, user);
+			rectangles++;
+		}
+	}
+	ili9341_streamEnd();
+	return rectangles;
+}
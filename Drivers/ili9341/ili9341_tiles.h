@@ -0,0 +1,28 @@
+#ifndef ILI9341_TILES_H_
+#define ILI9341_TILES_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ili9341.h"
+
+// A full RGB565 frame does not fit in SRAM, so the screen is redrawn only where it has changed. 
+// The screen is divided into square tiles, and the tiles touched by ili9341_invalidate are marked dirty. 
+// ili9341_flushDirty merges the dirty tiles into as few rectangles as it can, and has the application 
+// render each rectangle into a small strip buffer, a band of rows at a time, which is then streamed 
+// to the panel behind a single address window.
+#define ILI9341_TILE_SIZE		16
+#define ILI9341_TILE_COLUMNS	(ILI9341_TFTWIDTH / ILI9341_TILE_SIZE)
+#define ILI9341_TILE_ROWS		(ILI9341_TFTHEIGHT / ILI9341_TILE_SIZE)
+// Pixels in the strip buffer. Must be at least one screen row.
+#define ILI9341_STRIP_PIXELS	(ILI9341_TFTWIDTH * 8)
+
+// Draws the part of the scene inside the rectangle into pixels, w*h RGB565 values row by row
+typedef void (*Ili9341RenderFunc)(uint16_t *pixels, int16_t x, int16_t y, int16_t w, int16_t h, void *user);
+
+void ili9341_invalidate(int16_t x, int16_t y, int16_t w, int16_t h);
+void ili9341_invalidateScreen(void);
+bool ili9341_isDirty(void);
+// Returns the number of rectangles that were sent
+uint16_t ili9341_flushDirty(Ili9341RenderFunc render, void *user);
+
+#endif /* ILI9341_TILES_H_ */
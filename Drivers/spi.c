@@ -2,75 +2,1047 @@
 #include "pmc.h"
 #include "pio.h"
 
-static void (*callBackFunctionPointer)(void); // Make a function pointer so that you can assign callback functions to it
+// The PDC counters are 16 bits, so longer segments are given to the PDC in chunks of at most this many words
+#define SPI_PDC_MAX_LENGTH 0xFFFF
 
-SemaphoreHandle_t spi_handlerIsDoneSempahore = NULL;
-SemaphoreHandle_t spi_mutex = NULL;
+// A piece of a transfer that fits in the PDC counters
+struct SpiChunk {
+	struct SpiTransfer *transfer; // NULL when the slot is empty
+	void *transmit_buffer;
+	void *receive_buffer;
+	uint16_t length;
+	bool last; // The last chunk of the transfer
+	struct SpiTransfer *merged; // Transfers that end inside this chunk before transfer starts, linked by next
+};
 
-static void spi_tranceive(uint32_t *transmit_buffer, uint8_t buffer_length, uint32_t *receive_buffer ) {
-	NVIC_EnableIRQ(SPI_IRQn);
-	SPI->SPI_CR = 1 << 0;	
-	//xSemaphoreTake(spi_handlerIsDoneSempahore, portMAX_DELAY);
-	SPI->SPI_TPR = transmit_buffer; // Give address to tdr register
-	SPI->SPI_TCR = buffer_length;  // Give it length of transmit buffer
-	SPI->SPI_RPR = receive_buffer; // Give address to rpr register
-	SPI->SPI_RCR = buffer_length; // Give it length of receive buffer
-	SPI->SPI_PTCR |= 1<<8; // Enable PDC transmit
-	SPI->SPI_PTCR |= 1<<0; // Enable PDC receive
+// One queue of submitted transfers per chip select. spi_loadingTransfer is the transfer whose chunks 
+// are being given to the PDC. spi_pdcCurrent is the chunk in the PDC pointer/counter registers and 
+// spi_pdcNext is the one preloaded in the PDC next pointer/counter registers.
+// Only changed inside a critical section or from SPI_Handler.
+static struct SpiChunk spi_pdcCurrent;
+static struct SpiChunk spi_pdcNext;
+static struct SpiTransfer *spi_loadingTransfer = NULL;
+static struct SpiTransfer *spi_queueHead[4];
+static struct SpiTransfer *spi_queueTail[4];
+
+// Arbitration between the chip select queues
+static struct SpiQos spi_qos[4];
+static struct SpiStatistics spi_statistics[4];
+static uint32_t spi_busySince; // When the chunk now on the bus was started
+static enum SpiChipSelect spi_lastServedChipSelect = NPCS3;
+
+// bits_per_transfer given to spi_chipSelectInit, and the setup SPI_MR and SPI_CSR are in now
+static uint8_t spi_chipSelectBits[4] = {8, 8, 8, 8};
+static enum SpiWordFormat spi_activeFormat = SPI_FORMAT_PDC_WORD;
+static enum SpiChipSelect spi_activeChipSelect = NPCS0;
+
+// Called for every finished transfer to the chip select, after the transfer's own callback
+static void (*spi_chipSelectCallBack[4])(void *user, enum SpiTransferStatus status);
+static void *spi_chipSelectUser[4];
+
+// Set while a task drives the bus without the PDC. Transfers submitted meanwhile wait in the queue.
+static bool spi_busLocked = false;
+static uint32_t spi_polledThreshold = SPI_DEFAULT_POLLED_THRESHOLD;
+
+// Slave mode receive ring. Positions are counted in bytes since spi_slaveInit and wrap at 2^32, 
+// the place in the ring is the position modulo spi_slaveRingLength. The length is a power of two, 
+// so that the place does not jump when the position wraps.
+static bool spi_slaveMode = false;
+static uint8_t *spi_slaveRing;
+static uint32_t spi_slaveRingLength;
+static uint32_t spi_slaveBlockLength;
+static uint8_t spi_slaveWordSize;
+static uint32_t spi_slaveCurrentEnd; // End of the block in RPR/RCR
+static uint32_t spi_slaveArmedEnd; // End of the block in RNPR/RNCR, or spi_slaveCurrentEnd if there is none
+static bool spi_slaveStalled;
+static uint32_t spi_slaveReadPosition; // Everything before this has been released by the reader
+static uint64_t spi_slaveTotalEnd; // spi_slaveCurrentEnd without the wrap, for the statistics
+static TaskHandle_t spi_slaveReader = NULL;
+static struct SpiSlaveStatistics spi_slaveStatistics;
+
+static uint32_t spi_timestamp(void) {
+	return DWT->CYCCNT;
+}
+
+static void spi_countQueued(enum SpiChipSelect chip_select) {
+	struct SpiStatistics *statistics = &spi_statistics[chip_select];
+	statistics->queue_depth++;
+	if (statistics->queue_depth > statistics->max_queue_depth) {
+		statistics->max_queue_depth = statistics->queue_depth;
+	}
+}
+
+static void spi_pushQueue(struct SpiTransfer *transfer) {
+	enum SpiChipSelect chip_select = transfer->chip_select;
+	transfer->next = NULL;
+	if (spi_queueTail[chip_select] == NULL) {
+		spi_queueHead[chip_select] = transfer;
+	}
+	else {
+		spi_queueTail[chip_select]->next = transfer;
+	}
+	spi_queueTail[chip_select] = transfer;
+	spi_countQueued(chip_select);
+}
+
+// Put a transfer that was preempted back in front of its queue
+static void spi_pushQueueFront(struct SpiTransfer *transfer) {
+	enum SpiChipSelect chip_select = transfer->chip_select;
+	transfer->next = spi_queueHead[chip_select];
+	spi_queueHead[chip_select] = transfer;
+	if (spi_queueTail[chip_select] == NULL) {
+		spi_queueTail[chip_select] = transfer;
+	}
+	spi_countQueued(chip_select);
+}
+
+static void spi_popQueue(enum SpiChipSelect chip_select) {
+	struct SpiTransfer *transfer = spi_queueHead[chip_select];
+	spi_queueHead[chip_select] = transfer->next;
+	if (spi_queueHead[chip_select] == NULL) {
+		spi_queueTail[chip_select] = NULL;
+	}
+	spi_statistics[chip_select].queue_depth--;
+}
+
+// The chip select with the most urgent waiting transfer, or -1 if all queues are empty.
+// Chip selects with the same priority take turns.
+static int8_t spi_mostUrgentChipSelect(void) {
+	int8_t most_urgent = -1;
+	for (uint8_t i = 1; i <= 4; i++) {
+		uint8_t chip_select = (spi_lastServedChipSelect + i) & 3;
+		if ((spi_queueHead[chip_select] != NULL) && 
+			((most_urgent < 0) || (spi_qos[chip_select].priority > spi_qos[most_urgent].priority))) {
+			most_urgent = chip_select;
+		}
+	}
+	return most_urgent;
+}
+
+static bool spi_queuesAreEmpty(void) {
+	return (spi_loadingTransfer == NULL) && (spi_mostUrgentChipSelect() < 0);
+}
+
+static uint8_t spi_wordSize(enum SpiWordFormat format) {
+	switch (format) {
+		case SPI_FORMAT_PACKED_8:
+		return 1;
+		case SPI_FORMAT_PACKED_16:
+		return 2;
+		default:
+		return 4;
+	}
+}
+
+// The transfer the next chunk will be cut from, without taking it from the queue. 
+// The transfer being loaded keeps the bus until it is done, or until it has used its hold time 
+// and a transfer with a higher priority is waiting.
+static struct SpiTransfer *spi_peekTransfer(void) {
+	int8_t most_urgent = spi_mostUrgentChipSelect();
+	struct SpiTransfer *loading = spi_loadingTransfer;
+	
+	if ((loading != NULL) && 
+		((most_urgent < 0) || 
+		 (spi_qos[loading->chip_select].max_hold_words == 0) || 
+		 (loading->hold_remaining > 0) || 
+		 (spi_qos[most_urgent].priority <= spi_qos[loading->chip_select].priority))) {
+		return loading;
+	}
+	return (most_urgent < 0) ? NULL : spi_queueHead[most_urgent];
+}
+
+// SPI_MR and SPI_CSR can only be changed while the bus is idle, so a transfer can only be 
+// chained behind one that uses the same setup
+static bool spi_sameSetup(const struct SpiTransfer *a, const struct SpiTransfer *b) {
+	return (a->format == b->format) && ((a->format == SPI_FORMAT_PDC_WORD) || (a->chip_select == b->chip_select));
+}
+
+// Switch between variable peripheral select (PCS in every PDC word) and fixed peripheral select 
+// (PCS in SPI_MR, plain 8 or 16-bit PDC data). Must only be called while the bus is idle.
+static void spi_applySetup(const struct SpiTransfer *transfer) {
+	if ((transfer->format == spi_activeFormat) && 
+		((transfer->format == SPI_FORMAT_PDC_WORD) || (transfer->chip_select == spi_activeChipSelect))) {
+		return;
+	}
+	if (spi_activeFormat != SPI_FORMAT_PDC_WORD) {
+		// Give the chip select used in fixed mode back its own word length
+		SPI->SPI_CSR[spi_activeChipSelect] = (SPI->SPI_CSR[spi_activeChipSelect] & ~SPI_CSR_BITS_Msk) | 
+			SPI_CSR_BITS(spi_chipSelectBits[spi_activeChipSelect] - 8);
+	}
+	
+	uint32_t mode_register = SPI->SPI_MR & ~(SPI_MR_PS | SPI_MR_PCS_Msk);
+	if (transfer->format == SPI_FORMAT_PDC_WORD) {
+		mode_register |= SPI_MR_PS; // Variable peripheral select
+	}
+	else {
+		uint8_t bits = 8;
+		if (transfer->format == SPI_FORMAT_PACKED_16) {
+			bits = (spi_chipSelectBits[transfer->chip_select] > 8) ? spi_chipSelectBits[transfer->chip_select] : 16;
+		}
+		SPI->SPI_CSR[transfer->chip_select] = (SPI->SPI_CSR[transfer->chip_select] & ~SPI_CSR_BITS_Msk) | SPI_CSR_BITS(bits - 8);
+		// Same PCS encoding as in spi_word, with chip select decode disabled
+		mode_register |= SPI_MR_PCS((1 << transfer->chip_select) - 1);
+	}
+	SPI->SPI_MR = mode_register;
+	spi_activeFormat = transfer->format;
+	spi_activeChipSelect = transfer->chip_select;
+}
+
+// Take the transfer the next chunk will be cut from and make it the one being loaded
+static struct SpiTransfer *spi_selectTransfer(void) {
+	struct SpiTransfer *upcoming = spi_peekTransfer();
+	if (upcoming == NULL) {
+		return NULL;
+	}
+	if (upcoming != spi_loadingTransfer) {
+		if (spi_loadingTransfer != NULL) {
+			// Preempted. It goes on from where it was when its chip select is served again
+			spi_statistics[spi_loadingTransfer->chip_select].preemptions++;
+			spi_pushQueueFront(spi_loadingTransfer);
+		}
+		spi_popQueue(upcoming->chip_select);
+		spi_loadingTransfer = upcoming;
+		spi_lastServedChipSelect = upcoming->chip_select;
+		upcoming->hold_remaining = 0;
+		
+		if ((upcoming->segment_index == 0) && (upcoming->segment_offset == 0) && (upcoming->segment_repeat == 0)) {
+			struct SpiStatistics *statistics = &spi_statistics[upcoming->chip_select];
+			uint32_t wait_cycles = spi_timestamp() - upcoming->submit_time;
+			statistics->transfers++;
+			statistics->total_wait_cycles += wait_cycles;
+			if (wait_cycles > statistics->max_wait_cycles) {
+				statistics->max_wait_cycles = wait_cycles;
+			}
+		}
+	}
+	if (upcoming->hold_remaining == 0) {
+		upcoming->hold_remaining = spi_qos[upcoming->chip_select].max_hold_words;
+	}
+	return upcoming;
+}
+
+// The segment a transfer's cursor is in
+static struct SpiSegment spi_currentSegment(const struct SpiTransfer *transfer) {
+	if (transfer->segments != NULL) {
+		return transfer->segments[transfer->segment_index];
+	}
+	struct SpiSegment single_segment = {
+		.transmit_buffer = transfer->transmit_buffer,
+		.receive_buffer = transfer->receive_buffer,
+		.length = transfer->buffer_length,
+		.repeat = 0
+	};
+	return single_segment;
+}
+
+// Cut at most max_length words from the loading transfer, from its cursor to the end of the segment 
+// the cursor is in. Returns the number of words cut, and sets *last if that was the end of the transfer.
+static uint16_t spi_cutLoadingTransfer(uint16_t max_length, void **transmit_buffer, void **receive_buffer, bool *last) {
+	struct SpiTransfer *transfer = spi_loadingTransfer;
+	struct SpiSegment segment = spi_currentSegment(transfer);
+	uint16_t segment_count = (transfer->segments != NULL) ? transfer->segment_count : 1;
+	uint32_t remaining = segment.length - transfer->segment_offset;
+	uint32_t byte_offset = transfer->segment_offset * spi_wordSize(transfer->format);
+	uint16_t length = (remaining > max_length) ? max_length : remaining;
+	
+	if (transfer->hold_remaining > 0) {
+		// Give the arbiter a chance to let a more urgent chip select in after this chunk
+		if (length > transfer->hold_remaining) {
+			length = transfer->hold_remaining;
+		}
+		transfer->hold_remaining -= length;
+	}
+	*transmit_buffer = (uint8_t *)segment.transmit_buffer + byte_offset;
+	*receive_buffer = (segment.receive_buffer != NULL) ? (uint8_t *)segment.receive_buffer + byte_offset : NULL;
+	
+	transfer->segment_offset += length;
+	if (transfer->segment_offset == segment.length) {
+		transfer->segment_offset = 0;
+		transfer->segment_repeat++;
+		if (transfer->segment_repeat >= segment.repeat) {
+			transfer->segment_index++;
+			transfer->segment_repeat = 0;
+		}
+	}
+	*last = (transfer->segment_index == segment_count);
+	if (*last) {
+		spi_loadingTransfer = NULL;
+	}
+	return length;
+}
+
+// A queued transfer can be merged into the chunk if it goes to the same chip select in the same format, 
+// and its first segment starts right where the chunk ends in memory and fits in the PDC counters. 
+// spi_word chunks that end with LASTXFER are not merged, since the chip select has to be released there, 
+// and the buffers belong to the caller.
+static bool spi_canCoalesce(const struct SpiChunk *chunk, const struct SpiTransfer *transfer) {
+	if ((transfer == NULL) || (transfer->chip_select != chunk->transfer->chip_select) || 
+		(transfer->format != chunk->transfer->format) || 
+		(transfer->segment_index != 0) || (transfer->segment_offset != 0) || (transfer->segment_repeat != 0)) {
+		return false;
+	}
+	if ((chunk->transfer->format == SPI_FORMAT_PDC_WORD) && (chunk->length != 0) && 
+		(((const uint32_t *)chunk->transmit_buffer)[chunk->length - 1] & SPI_TDR_LASTXFER)) {
+		return false;
+	}
+	struct SpiSegment segment = spi_currentSegment(transfer);
+	uint32_t chunk_bytes = chunk->length * spi_wordSize(chunk->transfer->format);
+	bool receive_follows = (chunk->receive_buffer == NULL) ? (segment.receive_buffer == NULL) : 
+		(segment.receive_buffer == (uint8_t *)chunk->receive_buffer + chunk_bytes);
+	return (segment.transmit_buffer == (uint8_t *)chunk->transmit_buffer + chunk_bytes) && receive_follows && 
+		((uint32_t)chunk->length + segment.length <= SPI_PDC_MAX_LENGTH);
+}
+
+// Cut the next chunk from the queued transfers. Returns false if there is nothing more to send.
+static bool spi_nextChunk(struct SpiChunk *chunk) {
+	chunk->merged = NULL;
+	chunk->transfer = spi_selectTransfer();
+	if (chunk->transfer == NULL) {
+		return false;
+	}
+	chunk->length = spi_cutLoadingTransfer(SPI_PDC_MAX_LENGTH, &chunk->transmit_buffer, &chunk->receive_buffer, &chunk->last);
+	
+	// Small transfers to one device that lie back to back in memory, like an address window followed by 
+	// its pixel data, are sent as one PDC run to save an interrupt per transfer
+	struct SpiTransfer *merged_tail = NULL;
+	while (chunk->last && spi_canCoalesce(chunk, spi_peekTransfer())) {
+		struct SpiTransfer *finished = chunk->transfer;
+		finished->next = NULL;
+		if (merged_tail == NULL) {
+			chunk->merged = finished;
+		}
+		else {
+			merged_tail->next = finished;
+		}
+		merged_tail = finished;
+		
+		void *transmit_buffer;
+		void *receive_buffer;
+		chunk->transfer = spi_selectTransfer();
+		chunk->length += spi_cutLoadingTransfer(SPI_PDC_MAX_LENGTH - chunk->length, &transmit_buffer, &receive_buffer, &chunk->last);
+	}
+	return true;
+}
+
+// A chunk without a receive buffer only uses the PDC transmit channel. It is followed with the 
+// transmit counters, and the words the SPI receives meanwhile are left to overrun in SPI_RDR.
+static bool spi_writeOnly(const struct SpiChunk *chunk) {
+	return chunk->receive_buffer == NULL;
+}
+
+// Whether the next chunk cut from the transfer will be write only
+static bool spi_transferWritesOnly(const struct SpiTransfer *transfer) {
+	return spi_currentSegment(transfer).receive_buffer == NULL;
+}
+
+// The PDC counter that tells how much of the current chunk is left
+static uint32_t spi_pdcCount(const struct SpiChunk *chunk) {
+	return spi_writeOnly(chunk) ? SPI->SPI_TCR : SPI->SPI_RCR;
+}
+
+static uint32_t spi_pdcNextCount(const struct SpiChunk *chunk) {
+	return spi_writeOnly(chunk) ? SPI->SPI_TNCR : SPI->SPI_RNCR;
+}
+
+// Start the PDC on a chunk. Must only be called while the bus is idle.
+static void spi_tranceive(const struct SpiChunk *chunk) {
+	spi_applySetup(chunk->transfer);
+	SPI->SPI_CR = SPI_CR_SPIEN;
+	SPI->SPI_PTCR = SPI_PTCR_TXTDIS | SPI_PTCR_RXTDIS;
+	if (spi_writeOnly(chunk)) {
+		SPI->SPI_RCR = 0;
+		SPI->SPI_RNCR = 0;
+		SPI->SPI_TPR = (uint32_t)chunk->transmit_buffer; // Give address to tdr register
+		SPI->SPI_TCR = chunk->length;  // Give it length of transmit buffer
+		SPI->SPI_PTCR = SPI_PTCR_TXTEN; // Enable PDC transmit only
+		spi_busySince = spi_timestamp();
+		// ENDTX is cleared by writing TCR. Overruns are expected, since nobody reads SPI_RDR.
+		SPI->SPI_IDR = SPI_IDR_ENDRX | SPI_IDR_OVRES | SPI_IDR_TXEMPTY;
+		SPI->SPI_IER = SPI_IER_ENDTX;
+		return;
+	}
+	// Throw away the word and the overrun a write only chunk may have left behind, 
+	// or the PDC would store the stale word as the first one received
+	SPI->SPI_RDR;
+	SPI->SPI_SR;
+	SPI->SPI_RPR = (uint32_t)chunk->receive_buffer; // Give address to rpr register
+	SPI->SPI_RCR = chunk->length; // Give it length of receive buffer
+	SPI->SPI_TPR = (uint32_t)chunk->transmit_buffer; // Give address to tdr register
+	SPI->SPI_TCR = chunk->length;  // Give it length of transmit buffer
+	SPI->SPI_PTCR = SPI_PTCR_TXTEN | SPI_PTCR_RXTEN; // Enable PDC transmit and receive
+	spi_busySince = spi_timestamp();
+	// ENDRX is cleared by writing RCR, so it will not be set until the last word is received
+	SPI->SPI_IDR = SPI_IDR_ENDTX | SPI_IDR_TXEMPTY;
+	SPI->SPI_IER = SPI_IER_ENDRX | SPI_IER_OVRES;
+}
+
+// Preload the PDC next registers. When the current buffer is done the PDC moves these into the 
+// pointer/counter registers by itself, so the bus does not idle between the buffers.
+// The chunk must be write only if and only if the current one is.
+static void spi_tranceiveNext(const struct SpiChunk *chunk) {
+	// RX is set up first since TX is the one that starts the clock
+	if (!spi_writeOnly(chunk)) {
+		SPI->SPI_RNPR = (uint32_t)chunk->receive_buffer;
+		SPI->SPI_RNCR = chunk->length;
+	}
+	SPI->SPI_TNPR = (uint32_t)chunk->transmit_buffer;
+	SPI->SPI_TNCR = chunk->length;
+	// The transmit channel runs ahead of the receive channel, and may have given the SPI its last word
+	// before TNCR was written. It does not reload then, so the chunk is moved in by hand.
+	if (!spi_writeOnly(chunk) && (SPI->SPI_TCR == 0) && (SPI->SPI_TNCR != 0)) {
+		SPI->SPI_TPR = SPI->SPI_TNPR;
+		SPI->SPI_TCR = SPI->SPI_TNCR;
+		SPI->SPI_TNCR = 0;
+	}
+}
+
+static void spi_completeTransfer(struct SpiTransfer *transfer, BaseType_t *higherPriorityTaskWoken) {
+	enum SpiTransferStatus status = transfer->overrun ? SPI_TRANSFER_OVERRUN : SPI_TRANSFER_DONE;
+	enum SpiChipSelect chip_select = transfer->chip_select;
+	void (*transferCallBack)(void *user, enum SpiTransferStatus status) = transfer->callBackFunc;
+	void *user = transfer->user;
+	TaskHandle_t notify_task = transfer->notify_task;
+	
+	// The owner may reuse the descriptor as soon as the status is set, so everything needed is read first
+	transfer->complete_time = spi_timestamp();
+	transfer->status = status;
+	if (transferCallBack != NULL) {
+		transferCallBack(user, status);
+	}
+	if (spi_chipSelectCallBack[chip_select] != NULL) {
+		spi_chipSelectCallBack[chip_select](spi_chipSelectUser[chip_select], status);
+	}
+	if (notify_task != NULL) {
+		vTaskNotifyGiveFromISR(notify_task, higherPriorityTaskWoken);
+	}
+}
+
+// Start the PDC on the queue if the bus is idle. Must be called with the SPI interrupt masked.
+static void spi_startQueue(void) {
+	if (spi_busLocked) {
+		return;
+	}
+	if (spi_pdcCurrent.transfer == NULL) {
+		if (!spi_nextChunk(&spi_pdcCurrent)) {
+			return;
+		}
+		spi_tranceive(&spi_pdcCurrent);
+	}
+	if (spi_pdcNext.transfer == NULL) {
+		// Let SPI_Handler preload the next chunk into the next registers
+		NVIC_SetPendingIRQ(SPI_IRQn);
+	}
+}
+
+// Put a transfer in the queue and start the bus if it is idle. Must be called with the SPI interrupt masked.
+static void spi_enqueueTransfer(struct SpiTransfer *transfer) {
+	transfer->status = SPI_TRANSFER_PENDING;
+	transfer->overrun = false;
+	transfer->segment_index = 0;
+	transfer->segment_repeat = 0;
+	transfer->segment_offset = 0;
+	transfer->submit_time = spi_timestamp();
+	spi_pushQueue(transfer);
+	
+	spi_startQueue();
+}
+
+void spi_submitTransfer(struct SpiTransfer *transfer) {
+	taskENTER_CRITICAL();
+	spi_enqueueTransfer(transfer);
+	taskEXIT_CRITICAL();
+}
+
+void spi_submitTransferFromISR(struct SpiTransfer *transfer) {
+	UBaseType_t interrupt_status = taskENTER_CRITICAL_FROM_ISR();
+	spi_enqueueTransfer(transfer);
+	taskEXIT_CRITICAL_FROM_ISR(interrupt_status);
+}
+
+bool spi_transferIsDone(struct SpiTransfer *transfer) {
+	return transfer->status != SPI_TRANSFER_PENDING;
+}
+
+// Put how long a task took to wake up after its transfer was done in the histogram
+static void spi_countWakeup(const struct SpiTransfer *transfer) {
+	uint32_t latency = spi_timestamp() - transfer->complete_time;
+	uint8_t bucket = 0;
+	while ((bucket < SPI_LATENCY_BUCKETS - 1) && (latency >= ((uint32_t)SPI_LATENCY_BUCKET_CYCLES << bucket))) {
+		bucket++;
+	}
+	taskENTER_CRITICAL();
+	spi_statistics[transfer->chip_select].wakeup_latency[bucket]++;
+	taskEXIT_CRITICAL();
+}
+
+enum SpiTransferStatus spi_waitForTransfer(struct SpiTransfer *transfer) {
+	if (transfer->status != SPI_TRANSFER_PENDING) {
+		return transfer->status;
+	}
+	// The notification count can also come from an earlier transfer, so check the status each time
+	while (transfer->status == SPI_TRANSFER_PENDING) {
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+	}
+	spi_countWakeup(transfer);
+	return transfer->status;
+}
+
+void spi_setChipSelectCallback(enum SpiChipSelect chip_select, void (*callBackFunc)(void *user, enum SpiTransferStatus status), void *user) {
+	taskENTER_CRITICAL();
+	spi_chipSelectCallBack[chip_select] = callBackFunc;
+	spi_chipSelectUser[chip_select] = user;
+	taskEXIT_CRITICAL();
+}
+
+void spi_setChipSelectQos(enum SpiChipSelect chip_select, struct SpiQos qos) {
+	taskENTER_CRITICAL();
+	spi_qos[chip_select] = qos;
+	taskEXIT_CRITICAL();
+}
+
+void spi_getStatistics(enum SpiChipSelect chip_select, struct SpiStatistics *statistics) {
+	taskENTER_CRITICAL();
+	*statistics = spi_statistics[chip_select];
+	taskEXIT_CRITICAL();
+}
+
+void spi_resetStatistics(void) {
+	taskENTER_CRITICAL();
+	for (uint8_t i = 0; i < 4; i++) {
+		// The queue depth is the state of the queue, not a count, so it is kept
+		uint16_t queue_depth = spi_statistics[i].queue_depth;
+		spi_statistics[i] = (struct SpiStatistics){ .queue_depth = queue_depth, .max_queue_depth = queue_depth };
+	}
+	taskEXIT_CRITICAL();
+}
+
+void spi_setPolledThreshold(uint32_t max_words) {
+	spi_polledThreshold = max_words;
+}
+
+// Send words through SPI_TDR/SPI_RDR. Words that are only written are given to SPI_TDR as soon as it is 
+// free, and the last one is waited for, so the bus is idle when this returns.
+static void spi_pollWords(uint8_t word_size, const void *transmit_buffer, void *receive_buffer, uint32_t length) {
+	const uint8_t *transmit = transmit_buffer;
+	uint8_t *receive = receive_buffer;
+	for (uint32_t i = 0; i < length; i++) {
+		uint32_t word;
+		switch (word_size) {
+			case 1:
+			word = transmit[i];
+			break;
+			case 2:
+			word = ((const uint16_t *)transmit)[i];
+			break;
+			default:
+			word = ((const uint32_t *)transmit)[i]; // PCS and LASTXFER go to SPI_TDR as well
+			break;
+		}
+		while (!(SPI->SPI_SR & SPI_SR_TDRE));
+		SPI->SPI_TDR = word;
+		if (receive == NULL) {
+			continue; // The received words overrun in SPI_RDR, a receiving transfer throws them away first
+		}
+		while (!(SPI->SPI_SR & SPI_SR_RDRF));
+		word = SPI->SPI_RDR;
+		switch (word_size) {
+			case 1:
+			receive[i] = word;
+			break;
+			case 2:
+			((uint16_t *)receive)[i] = word;
+			break;
+			default:
+			((uint32_t *)receive)[i] = word;
+			break;
+		}
+	}
+	if (receive == NULL) {
+		while (!(SPI->SPI_SR & SPI_SR_TXEMPTY));
+	}
+}
+
+// Take the bus for a polled transfer if nothing else is using it
+static bool spi_lockBusForPolling(void) {
+	bool locked = false;
+	taskENTER_CRITICAL();
+	if ((spi_pdcCurrent.transfer == NULL) && spi_queuesAreEmpty() && !spi_busLocked) {
+		spi_busLocked = true;
+		locked = true;
+	}
+	taskEXIT_CRITICAL();
+	return locked;
+}
+
+// Count a polled transfer and give the bus back
+static void spi_unlockBusAfterPolling(enum SpiChipSelect chip_select, uint32_t words, uint32_t start_time) {
+	taskENTER_CRITICAL();
+	struct SpiStatistics *statistics = &spi_statistics[chip_select];
+	statistics->transfers++;
+	statistics->words += words;
+	statistics->busy_cycles += spi_timestamp() - start_time;
+	spi_busLocked = false;
+	if (!spi_queuesAreEmpty()) {
+		// Start what was submitted while the bus was locked
+		spi_startQueue();
+	}
+	else {
+		// Same as when the PDC runs out of work. Disabling the SPI releases the chip select
+		SPI->SPI_CR = SPI_CR_SPIDIS;
+	}
+	taskEXIT_CRITICAL();
+}
+
+// Run a transfer and wait for it. Short transfers are polled if the bus is free, since the PDC 
+// interrupt and the task switches cost more than the transfer itself.
+static enum SpiTransferStatus spi_tranceiveBlocking(struct SpiTransfer *transfer) {
+	// A transfer with a callback goes through the queue, so the callback runs in SPI_Handler
+	if ((transfer->segments != NULL) || (transfer->callBackFunc != NULL) || (transfer->buffer_length > spi_polledThreshold) || 
+		!spi_lockBusForPolling()) {
+		spi_submitTransfer(transfer);
+		return spi_waitForTransfer(transfer);
+	}
 	
+	uint32_t start_time = spi_timestamp();
+	spi_applySetup(transfer);
+	SPI->SPI_CR = SPI_CR_SPIEN;
+	SPI->SPI_RDR; // Throw away anything left in the receive register
+	spi_pollWords(spi_wordSize(transfer->format), transfer->transmit_buffer, transfer->receive_buffer, transfer->buffer_length);
+	transfer->status = SPI_TRANSFER_DONE;
+	spi_unlockBusAfterPolling(transfer->chip_select, transfer->buffer_length, start_time);
+	return transfer->status;
+}
+
+// The chip select a PDC word addresses, from its PCS field. The lowest clear bit selects, see spi_pcsPrefix.
+static enum SpiChipSelect spi_wordChipSelect(uint32_t word) {
+	uint8_t pcs = (word & SPI_TDR_PCS_Msk) >> SPI_TDR_PCS_Pos;
+	uint8_t chip_select = NPCS0;
+	while ((chip_select < NPCS3) && (pcs & (1 << chip_select))) {
+		chip_select++;
+	}
+	return chip_select;
 }
 
-void spi_freeRTOSTranceive(uint32_t  *transmit_buffer, uint8_t buffer_length, void (*callBackFunc)(void), uint32_t *receive_buffer ) {
-	//Acquire the spi resource
-	xSemaphoreTake(spi_mutex,portMAX_DELAY);
-	callBackFunctionPointer = callBackFunc;
-	spi_tranceive(transmit_buffer, buffer_length, receive_buffer);
-	// Wait for the SPI_Handler to run ,and signal that the transfer is complete
-	xSemaphoreTake(spi_handlerIsDoneSempahore, portMAX_DELAY);
+// The callback of spi_freeRTOSTranceive takes no arguments, user points to it
+static void spi_legacyCallBack(void *user, enum SpiTransferStatus status) {
+	void (*callBackFunc)(void) = *(void (**)(void))user;
+	callBackFunc();
+}
+
+void spi_freeRTOSTranceive(uint32_t  *transmit_buffer, uint32_t buffer_length, void (*callBackFunc)(void), uint32_t *receive_buffer ) {
+	struct SpiTransfer transfer = {
+		.transmit_buffer = transmit_buffer,
+		.receive_buffer = receive_buffer,
+		.buffer_length = buffer_length,
+		.segments = NULL,
+		.format = SPI_FORMAT_PDC_WORD,
+		// Queued, limited and counted under the chip select the words go to
+		.chip_select = ((transmit_buffer != NULL) && (buffer_length != 0)) ? spi_wordChipSelect(transmit_buffer[0]) : NPCS0,
+		.callBackFunc = NULL,
+		.user = NULL,
+		.notify_task = xTaskGetCurrentTaskHandle()
+	};
+	if (callBackFunc != NULL) {
+		// Called from SPI_Handler when the transfer is done, as before the queue. The transfer and 
+		// callBackFunc stay on this stack frame until then, since this function waits for it.
+		transfer.callBackFunc = spi_legacyCallBack;
+		transfer.user = &callBackFunc;
+	}
+	spi_tranceiveBlocking(&transfer);
+}
+
+// Count a chunk the PDC has finished. The next chunk on the bus is taken to start now.
+static void spi_countChunk(const struct SpiChunk *chunk) {
+	// Everything in a chunk goes to one chip select
+	struct SpiStatistics *statistics = &spi_statistics[chunk->transfer->chip_select];
+	uint32_t now = spi_timestamp();
+	statistics->words += chunk->length;
+	statistics->busy_cycles += now - spi_busySince;
+	spi_busySince = now;
+}
+
+// Work out which of the loaded chunks the PDC has finished, refill the freed slots from the queue 
+// and signal the finished transfers. The counters are used instead of the status flags, since the PDC 
+// can finish the next buffer while this is running. The PDC is refilled before signalling, so that 
+// the bus is not left idle while callbacks run.
+static void spi_pdcService(BaseType_t *higherPriorityTaskWoken) {
+	while (spi_pdcCurrent.transfer != NULL) {
+		struct SpiChunk finished;
+		finished.transfer = NULL;
+		
+		// The next count must be read before the current count, so that a reload between the two reads is not mistaken for a stop
+		if ((spi_pdcNext.transfer != NULL) && (spi_pdcNextCount(&spi_pdcCurrent) == 0)) {
+			// The PDC has moved the next chunk into the current registers
+			finished = spi_pdcCurrent;
+			spi_countChunk(&finished);
+			spi_pdcCurrent = spi_pdcNext;
+			spi_pdcNext.transfer = NULL;
+		}
+		else if (spi_pdcCount(&spi_pdcCurrent) == 0) {
+			if ((spi_pdcNext.transfer == NULL) && spi_writeOnly(&spi_pdcCurrent) && !(SPI->SPI_SR & SPI_SR_TXEMPTY)) {
+				// The PDC has given the SPI the last words, but they are still being shifted out. 
+				// The transfer is not done, and the chip select and the setup may not change, until they are.
+				SPI->SPI_IDR = SPI_IDR_ENDTX;
+				SPI->SPI_IER = SPI_IER_TXEMPTY;
+				break;
+			}
+			finished = spi_pdcCurrent;
+			spi_countChunk(&finished);
+			if (spi_pdcNext.transfer != NULL) {
+				// The PDC stopped before the next registers were written, so it will not reload by itself
+				spi_pdcCurrent = spi_pdcNext;
+				spi_pdcNext.transfer = NULL;
+				SPI->SPI_RNCR = 0;
+				SPI->SPI_TNCR = 0;
+			}
+			else {
+				spi_nextChunk(&spi_pdcCurrent);
+			}
+			if (spi_pdcCurrent.transfer != NULL) {
+				spi_tranceive(&spi_pdcCurrent);
+			}
+		}
+		
+		if ((spi_pdcCurrent.transfer != NULL) && (spi_pdcNext.transfer == NULL)) {
+			struct SpiTransfer *upcoming = spi_peekTransfer();
+			if ((upcoming != NULL) && spi_sameSetup(upcoming, spi_pdcCurrent.transfer) && 
+				(spi_transferWritesOnly(upcoming) == spi_writeOnly(&spi_pdcCurrent))) {
+				spi_nextChunk(&spi_pdcNext);
+				spi_tranceiveNext(&spi_pdcNext);
+			}
+			else if (spi_writeOnly(&spi_pdcCurrent)) {
+				// Nothing that can be chained. It is started when the current chunk is done.
+				// Writing TNCR clears ENDTX
+				SPI->SPI_TNCR = 0;
+			}
+			else {
+				// Writing RNCR clears ENDRX
+				SPI->SPI_RNCR = 0;
+			}
+		}
+		
+		if (finished.transfer != NULL) {
+			while (finished.merged != NULL) {
+				struct SpiTransfer *merged = finished.merged;
+				finished.merged = merged->next; // Read first, the callback may submit it again
+				spi_completeTransfer(merged, higherPriorityTaskWoken);
+			}
+			if (finished.last) {
+				spi_completeTransfer(finished.transfer, higherPriorityTaskWoken);
+			}
+		}
+		else if (spi_pdcCount(&spi_pdcCurrent) != 0) {
+			break;
+		}
+		// Go around again, the PDC may have finished a chunk meanwhile
+	}
+}
+
+void spi_freeRTOSTranceivePacked(enum SpiChipSelect chip_select, enum SpiWordFormat format, void *transmit_buffer, uint32_t buffer_length, void *receive_buffer) {
+	struct SpiTransfer transfer = {
+		.transmit_buffer = transmit_buffer,
+		.receive_buffer = receive_buffer,
+		.buffer_length = buffer_length,
+		.segments = NULL,
+		.format = format,
+		.chip_select = chip_select,
+		.callBackFunc = NULL,
+		.user = NULL,
+		.notify_task = xTaskGetCurrentTaskHandle()
+	};
+	spi_tranceiveBlocking(&transfer);
+}
+
+void spi_freeRTOSTranceiveSequence(enum SpiChipSelect chip_select, enum SpiWordFormat format, const struct SpiSegment *segments, 
+	uint16_t segment_count, void (*beforeSegment)(void *user, uint16_t segment_index), void *user) {
+	bool polled = true;
+	for (uint16_t i = 0; i < segment_count; i++) {
+		uint32_t repeat = (segments[i].repeat > 1) ? segments[i].repeat : 1;
+		if ((uint64_t)segments[i].length * repeat > spi_polledThreshold) {
+			polled = false;
+		}
+	}
+	
+	if (polled && spi_lockBusForPolling()) {
+		uint32_t start_time = spi_timestamp();
+		uint32_t words = 0;
+		struct SpiTransfer setup = { .format = format, .chip_select = chip_select };
+		spi_applySetup(&setup);
+		SPI->SPI_CR = SPI_CR_SPIEN;
+		SPI->SPI_RDR; // Throw away anything left in the receive register
+		for (uint16_t i = 0; i < segment_count; i++) {
+			// spi_pollWords has waited for the segment before to be off the bus
+			if (beforeSegment != NULL) {
+				beforeSegment(user, i);
+			}
+			uint32_t repeat = (segments[i].repeat > 1) ? segments[i].repeat : 1;
+			for (uint32_t r = 0; r < repeat; r++) {
+				spi_pollWords(spi_wordSize(format), segments[i].transmit_buffer, segments[i].receive_buffer, segments[i].length);
+				words += segments[i].length;
+			}
+		}
+		spi_unlockBusAfterPolling(chip_select, words, start_time);
+		return;
+	}
 	
-	// Release spi resource
-	xSemaphoreGive(spi_mutex);
+	// Without anything to do between the segments they can go out back to back, otherwise 
+	// every segment is a transfer of its own, which is done when its last word is off the bus
+	uint16_t segments_per_transfer = (beforeSegment == NULL) ? segment_count : 1;
+	for (uint16_t i = 0; i < segment_count; i += segments_per_transfer) {
+		if (beforeSegment != NULL) {
+			beforeSegment(user, i);
+		}
+		struct SpiTransfer transfer = {
+			.segments = &segments[i],
+			.segment_count = segments_per_transfer,
+			.format = format,
+			.chip_select = chip_select,
+			.callBackFunc = NULL,
+			.user = NULL,
+			.notify_task = xTaskGetCurrentTaskHandle()
+		};
+		spi_submitTransfer(&transfer);
+		spi_waitForTransfer(&transfer);
+	}
+}
+
+void spi_freeRTOSTranceiveSegments(const struct SpiSegment *segments, uint16_t segment_count) {
+	struct SpiTransfer transfer = {
+		.segments = segments,
+		.segment_count = segment_count,
+		.format = SPI_FORMAT_PDC_WORD,
+		.chip_select = ((segment_count != 0) && (segments[0].length != 0)) ? 
+			spi_wordChipSelect(((const uint32_t *)segments[0].transmit_buffer)[0]) : NPCS0,
+		.callBackFunc = NULL,
+		.user = NULL,
+		.notify_task = xTaskGetCurrentTaskHandle()
+	};
+	spi_submitTransfer(&transfer);
+	spi_waitForTransfer(&transfer);
+}
+
+// A block can be given to the PDC if it does not overwrite data the reader has not released
+static bool spi_slaveHasRoom(void) {
+	return spi_slaveArmedEnd + spi_slaveBlockLength - spi_slaveReadPosition <= spi_slaveRingLength;
+}
+
+// The block in RNPR/RNCR has become the one the PDC receives into
+static void spi_slaveAdvanceCurrentEnd(void) {
+	spi_slaveTotalEnd += spi_slaveArmedEnd - spi_slaveCurrentEnd;
+	spi_slaveCurrentEnd = spi_slaveArmedEnd;
+}
+
+// Bring the ring up to date with the PDC and give it more blocks if there is room. 
+// Must be called with the SPI interrupt masked.
+static void spi_slaveService(void) {
+	while (1) {
+		// The next count must be read before the current count, so that a reload between the two reads is not mistaken for a stop
+		if (spi_slaveArmedEnd != spi_slaveCurrentEnd) {
+			if (SPI->SPI_RNCR == 0) {
+				// The PDC has moved on to the next block
+				spi_slaveAdvanceCurrentEnd();
+			}
+			else if (SPI->SPI_RCR == 0) {
+				// The PDC stopped before the next registers were written, so it will not reload by itself
+				SPI->SPI_RPR = SPI->SPI_RNPR;
+				SPI->SPI_RCR = SPI->SPI_RNCR;
+				SPI->SPI_RNCR = 0;
+				spi_slaveAdvanceCurrentEnd();
+			}
+		}
+		else if (!spi_slaveStalled && (SPI->SPI_RCR == 0)) {
+			// The PDC filled the last block it had and stopped. Words are lost until there is room.
+			spi_slaveStalled = true;
+			spi_slaveStatistics.stalls++;
+			SPI->SPI_IDR = SPI_IDR_ENDRX;
+		}
+		
+		if (spi_slaveHasRoom()) {
+			uint8_t *block = spi_slaveRing + (spi_slaveArmedEnd & (spi_slaveRingLength - 1));
+			if (spi_slaveStalled) {
+				SPI->SPI_RPR = (uint32_t)block;
+				SPI->SPI_RCR = spi_slaveBlockLength / spi_slaveWordSize;
+				spi_slaveArmedEnd += spi_slaveBlockLength;
+				spi_slaveAdvanceCurrentEnd();
+				spi_slaveStalled = false;
+				SPI->SPI_IER = SPI_IER_ENDRX;
+				block = spi_slaveRing + (spi_slaveArmedEnd & (spi_slaveRingLength - 1));
+			}
+			if ((spi_slaveArmedEnd == spi_slaveCurrentEnd) && spi_slaveHasRoom()) {
+				SPI->SPI_RNPR = (uint32_t)block;
+				SPI->SPI_RNCR = spi_slaveBlockLength / spi_slaveWordSize;
+				spi_slaveArmedEnd += spi_slaveBlockLength;
+			}
+		}
+		if ((spi_slaveArmedEnd == spi_slaveCurrentEnd) && !spi_slaveStalled) {
+			// No room for the next block. Writing RNCR clears ENDRX.
+			SPI->SPI_RNCR = 0;
+		}
+		
+		if (spi_slaveStalled || (SPI->SPI_RCR != 0)) {
+			break;
+		}
+		// Go around again, the PDC finished a block meanwhile
+	}
+}
+
+// Bytes received so far. The counter can move on to the next block between the reads, 
+// which makes the result too small, never too large.
+static uint32_t spi_slaveWritePosition(void) {
+	if (spi_slaveStalled) {
+		return spi_slaveCurrentEnd;
+	}
+	return spi_slaveCurrentEnd - SPI->SPI_RCR * spi_slaveWordSize;
+}
+
+uint32_t spi_slaveReceive(const void **data, TickType_t ticks_to_wait) {
+	uint32_t available;
+	while (1) {
+		taskENTER_CRITICAL();
+		spi_slaveService();
+		available = spi_slaveWritePosition() - spi_slaveReadPosition;
+		spi_slaveReader = (available == 0) ? xTaskGetCurrentTaskHandle() : NULL;
+		taskEXIT_CRITICAL();
+		
+		if (available > 0) {
+			break;
+		}
+		if (ulTaskNotifyTake(pdTRUE, ticks_to_wait) == 0) {
+			// SPI_Handler may be about to notify, so it has to see this
+			taskENTER_CRITICAL();
+			spi_slaveReader = NULL;
+			taskEXIT_CRITICAL();
+			return 0;
+		}
+	}
+	uint32_t start = spi_slaveReadPosition & (spi_slaveRingLength - 1);
+	if (available > spi_slaveRingLength - start) {
+		available = spi_slaveRingLength - start; // The rest is at the start of the ring
+	}
+	*data = spi_slaveRing + start;
+	return available;
+}
+
+void spi_slaveRelease(uint32_t length) {
+	taskENTER_CRITICAL();
+	spi_slaveReadPosition += length;
+	spi_slaveService();
+	taskEXIT_CRITICAL();
+}
+
+void spi_slaveSkipPositions(uint32_t count) {
+	taskENTER_CRITICAL();
+	spi_slaveService();
+	// Only an empty ring can be moved, and only by whole rings, so the blocks stay where they are
+	if ((spi_slaveWritePosition() != spi_slaveReadPosition) || (count & (spi_slaveRingLength - 1))) {
+		while(1);
+	}
+	spi_slaveCurrentEnd += count;
+	spi_slaveArmedEnd += count;
+	spi_slaveReadPosition += count;
+	taskEXIT_CRITICAL();
+}
+
+void spi_slaveGetStatistics(struct SpiSlaveStatistics *statistics) {
+	taskENTER_CRITICAL();
+	spi_slaveService();
+	*statistics = spi_slaveStatistics;
+	statistics->bytes_received = spi_slaveTotalEnd - (spi_slaveCurrentEnd - spi_slaveWritePosition());
+	taskEXIT_CRITICAL();
+}
+
+static void spi_slaveHandler(uint32_t status, BaseType_t *higherPriorityTaskWoken) {
+	if (status & SPI_SR_OVRES) {
+		spi_slaveStatistics.overruns++;
+	}
+	spi_slaveService();
+	// A block is full or the master has released the slave select, so there is something to read
+	if ((spi_slaveReader != NULL) && (spi_slaveWritePosition() != spi_slaveReadPosition)) {
+		vTaskNotifyGiveFromISR(spi_slaveReader, higherPriorityTaskWoken);
+		spi_slaveReader = NULL;
+	}
 }
 
 void SPI_Handler(void) {
-	NVIC_DisableIRQ(SPI_IRQn);
-	long lHigherPriorityTaskWoken = pdFALSE;
-	SPI->SPI_SR; // MUST READ SR TO CLEAR NSSR
-	if (callBackFunctionPointer != NULL) {
-		callBackFunctionPointer();
+	BaseType_t higherPriorityTaskWoken = pdFALSE;
+	uint32_t status = SPI->SPI_SR; // MUST READ SR TO CLEAR NSSR (and OVRES)
+	
+	if (spi_slaveMode) {
+		spi_slaveHandler(status, &higherPriorityTaskWoken);
+		portEND_SWITCHING_ISR(higherPriorityTaskWoken);
+		return;
 	}
-	if (spi_handlerIsDoneSempahore != NULL) {
-		xSemaphoreGiveFromISR(spi_handlerIsDoneSempahore,&lHigherPriorityTaskWoken);
+	
+	if ((status & SPI_SR_OVRES) && (spi_pdcCurrent.transfer != NULL) && !spi_writeOnly(&spi_pdcCurrent)) {
+		// A received word was lost. The PDC can not tell which one, so blame the chunk in progress
+		spi_pdcCurrent.transfer->overrun = true;
 	}
-	SPI->SPI_CR = 1 << 1;
-	SPI->SPI_PTCR |= 1 << 9;
-	SPI->SPI_PTCR |= 1 << 1;
 	
+	// Runs on ENDRX, on ENDTX and TXEMPTY for write only chunks, and when spi_submitTransfer pends the interrupt to have the next registers filled
+	if (spi_pdcCurrent.transfer != NULL) {
+		spi_pdcService(&higherPriorityTaskWoken);
+		
+		if (spi_pdcCurrent.transfer == NULL) {
+			// Nothing more to send. Disabling the SPI releases the chip select
+			SPI->SPI_IDR = SPI_IDR_ENDRX | SPI_IDR_OVRES | SPI_IDR_ENDTX | SPI_IDR_TXEMPTY;
+			SPI->SPI_PTCR = SPI_PTCR_TXTDIS | SPI_PTCR_RXTDIS;
+			SPI->SPI_CR = SPI_CR_SPIDIS;
+		}
+	}
 	
-	portEND_SWITCHING_ISR(lHigherPriorityTaskWoken);
+	portEND_SWITCHING_ISR(higherPriorityTaskWoken);
 }
 
+// The PCS field of a PDC word for each chip select, with chip select decode disabled
+static const uint32_t spi_pcsPrefix[4] = {0 << 16, 1 << 16, 3 << 16, 7 << 16};
+
 uint32_t spi_word(bool last_xfer,uint8_t chip_select, uint16_t data) {
-	uint32_t chip_select_correct_format;
-	switch(chip_select) {
-		case 0:
-		chip_select_correct_format = 0;
-		break;
-		case 1:
-		chip_select_correct_format = 1 << 16;
-		break;
-		case 2:
-		chip_select_correct_format = 3 << 16;
-		break;
-		case 3:
-		chip_select_correct_format = 7 << 16;
-		break;
-	}
 	if (last_xfer) {
-		return ( (1<<24) | chip_select_correct_format | data);
+		return ( SPI_TDR_LASTXFER | spi_pcsPrefix[chip_select & 3] | data);
 	}
 	else {
-		return (chip_select_correct_format | data);
+		return (spi_pcsPrefix[chip_select & 3] | data);
+	}
+}
+
+void spi_encodeWords8(uint32_t *words, const uint8_t *data, uint32_t length, uint8_t chip_select, uint16_t flags, bool last_xfer) {
+	if (length == 0) {
+		return;
+	}
+	uint32_t prefix = spi_pcsPrefix[chip_select & 3] | flags;
+	uint32_t i = 0;
+	// Four at a time, so the loop overhead is paid once per four words
+	for (; i + 4 <= length; i += 4) {
+		words[i]     = prefix | data[i];
+		words[i + 1] = prefix | data[i + 1];
+		words[i + 2] = prefix | data[i + 2];
+		words[i + 3] = prefix | data[i + 3];
+	}
+	for (; i < length; i++) {
+		words[i] = prefix | data[i];
+	}
+	if (last_xfer) {
+		words[length - 1] |= SPI_TDR_LASTXFER;
+	}
+}
+
+void spi_encodeWords16(uint32_t *words, const uint16_t *data, uint32_t length, uint8_t chip_select, uint16_t flags, bool last_xfer) {
+	if (length == 0) {
+		return;
+	}
+	uint32_t prefix = spi_pcsPrefix[chip_select & 3] | flags;
+	uint32_t i = 0;
+	for (; i + 4 <= length; i += 4) {
+		words[i]     = prefix | data[i];
+		words[i + 1] = prefix | data[i + 1];
+		words[i + 2] = prefix | data[i + 2];
+		words[i + 3] = prefix | data[i + 3];
+	}
+	for (; i < length; i++) {
+		words[i] = prefix | data[i];
+	}
+	if (last_xfer) {
+		words[length - 1] |= SPI_TDR_LASTXFER;
 	}
 }
 
@@ -81,8 +1053,54 @@ void spi_setBaudRateHz(uint32_t peripheral_clock_hz, uint32_t baud_rate_hz, uint
 		while(1);
 	}
 	else {
-		SPI->SPI_CSR[chip_select] |= (peripheral_clock_hz/baud_rate_hz)  << 8;
+		spi_setClockDivider(chip_select, peripheral_clock_hz/baud_rate_hz);
+	}
+}
+
+void spi_setClockDivider(enum SpiChipSelect chip_select, uint8_t divider) {
+	if (divider == 0) {
+		while(1); // SCBR = 0 is not allowed
 	}
+	taskENTER_CRITICAL();
+	SPI->SPI_CSR[chip_select] = (SPI->SPI_CSR[chip_select] & ~SPI_CSR_SCBR_Msk) | SPI_CSR_SCBR(divider);
+	taskEXIT_CRITICAL();
+}
+
+uint8_t spi_getClockDivider(enum SpiChipSelect chip_select) {
+	return (SPI->SPI_CSR[chip_select] & SPI_CSR_SCBR_Msk) >> SPI_CSR_SCBR_Pos;
+}
+
+static bool spi_readbackIsStable(bool (*readback)(void *user), void *user) {
+	for (uint8_t i = 0; i < SPI_CALIBRATION_PASSES; i++) {
+		if (!readback(user)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+uint8_t spi_calibrateClock(enum SpiChipSelect chip_select, uint8_t slowest_divider, uint8_t margin_steps, bool (*readback)(void *user), void *user) {
+	uint8_t previous_divider = spi_getClockDivider(chip_select);
+	spi_setClockDivider(chip_select, slowest_divider);
+	if (!spi_readbackIsStable(readback, user)) {
+		// Leave the chip select as it was
+		if (previous_divider != 0) {
+			spi_setClockDivider(chip_select, previous_divider);
+		}
+		return 0;
+	}
+	uint8_t fastest = slowest_divider;
+	while (fastest > 1) {
+		spi_setClockDivider(chip_select, fastest - 1);
+		if (!spi_readbackIsStable(readback, user)) {
+			break;
+		}
+		fastest--;
+	}
+	
+	uint8_t divider = ((uint32_t)fastest + margin_steps < slowest_divider) ? fastest + margin_steps : slowest_divider;
+	spi_setClockDivider(chip_select, divider);
+	return divider;
 }
 
 
@@ -146,6 +1164,27 @@ static void spi_setupMux(struct SpiMaster spi_settings) {
 	}
 }
 
+static void spi_setMode(enum SpiChipSelect chip_select, enum SpiMode spi_mode) {
+	switch (spi_mode) {
+		case MODE_0:
+		SPI->SPI_CSR[chip_select] &= ~(1<<0);
+		SPI->SPI_CSR[chip_select] |= (1<<1);
+		break;
+		case MODE_1:
+		SPI->SPI_CSR[chip_select] &= ~(1<<0);
+		SPI->SPI_CSR[chip_select] &=  ~(1<<1);
+		break;
+		case MODE_2:
+		SPI->SPI_CSR[chip_select] |= (1<<0);
+		SPI->SPI_CSR[chip_select] |= (1<<1);
+		break;
+		case MODE_3:
+		SPI->SPI_CSR[chip_select] |= (1<<0);
+		SPI->SPI_CSR[chip_select] &= ~(1<<1);
+		break;
+	}
+}
+
 void spi_masterInit(struct SpiMaster SpiSettings) {
 	NVIC_DisableIRQ(SPI_IRQn);
 	NVIC_ClearPendingIRQ(SPI_IRQn);
@@ -153,6 +1192,10 @@ void spi_masterInit(struct SpiMaster SpiSettings) {
 	NVIC_EnableIRQ(SPI_IRQn);
 	
 	pmc_enable_periph_clk(SPI_IRQn); // Enable Spi clock
+	
+	// The cycle counter time stamps the transfers for the statistics
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
 	spi_setupMux(SpiSettings);
 	
 	SPI->SPI_CR |= SPI_CR_SPIEN; // Enable SPI
@@ -162,31 +1205,68 @@ void spi_masterInit(struct SpiMaster SpiSettings) {
 	SPI->SPI_MR &= ~(1<<4); // Disable mode fault detection
 	
 
-	SPI->SPI_IER  |= 1<<9;  // TXEMPTY Interrupt
-	SPI->SPI_PTCR |= 1<<8; // Enable PDC transmit
-	SPI->SPI_PTCR |= 1<<0; // Enable PDC receive
+	// The interrupts are enabled per transfer by spi_tranceive
+	SPI->SPI_IDR = 0xFFFFFFFF;
 }
 void spi_chipSelectInit(struct SpiSlaveSettings SpiCsSettings) {
+	spi_chipSelectBits[SpiCsSettings.chip_select] = SpiCsSettings.bits_per_transfer;
 	spi_setBaudRateHz(SpiCsSettings.peripheral_clock_hz,SpiCsSettings.spi_baudRate_hz,SpiCsSettings.chip_select);
-	switch (SpiCsSettings.spi_mode) {
-		case MODE_0:
-		SPI->SPI_CSR[SpiCsSettings.chip_select] &= ~(1<<0);
-		SPI->SPI_CSR[SpiCsSettings.chip_select] |= (1<<1);
-		break;
-		case MODE_1:
-		SPI->SPI_CSR[SpiCsSettings.chip_select] &= ~(1<<0);
-		SPI->SPI_CSR[SpiCsSettings.chip_select] &=  ~(1<<1);
-		break;
-		case MODE_2:
-		SPI->SPI_CSR[SpiCsSettings.chip_select] |= (1<<0);
-		SPI->SPI_CSR[SpiCsSettings.chip_select] |= (1<<1);
-		break;
-		case MODE_3:
-		SPI->SPI_CSR[SpiCsSettings.chip_select] |= (1<<0);
-		SPI->SPI_CSR[SpiCsSettings.chip_select] &= ~(1<<1);
-		break;
-	}
+	spi_setMode(SpiCsSettings.chip_select, SpiCsSettings.spi_mode);
 	SPI->SPI_CSR[SpiCsSettings.chip_select] |= (SpiCsSettings.bits_per_transfer-8) << 4;
 	SPI->SPI_CSR[SpiCsSettings.chip_select] |= SpiCsSettings.time_until_first_valid_SPCK << 16;
 	SPI->SPI_CSR[SpiCsSettings.chip_select] |= SpiCsSettings.delay_between_two_consecutive_transfers << 24;
-}
\ No newline at end of file
+}
+
+void spi_slaveInit(struct SpiSlave SpiSettings) {
+	uint8_t word_size = (SpiSettings.bits_per_transfer > 8) ? 2 : 1;
+	if ((SpiSettings.bits_per_transfer < 8) || (SpiSettings.bits_per_transfer > 16) || 
+		(SpiSettings.ring_length & (SpiSettings.ring_length - 1)) || 
+		(SpiSettings.block_length == 0) || (SpiSettings.ring_length % SpiSettings.block_length != 0) || 
+		(SpiSettings.ring_length < 2 * SpiSettings.block_length)) {
+		while(1);
+	}
+	// A block has to be whole words, and fit in the 16-bit PDC counter
+	if ((SpiSettings.block_length % word_size != 0) || (SpiSettings.block_length / word_size > SPI_PDC_MAX_LENGTH)) {
+		while(1);
+	}
+	NVIC_DisableIRQ(SPI_IRQn);
+	NVIC_ClearPendingIRQ(SPI_IRQn);
+	NVIC_SetPriority(SPI_IRQn,SpiSettings.NVIC_spi_interrupt_priority);
+	
+	pmc_enable_periph_clk(SPI_IRQn); // Enable Spi clock
+	pio_setMux(PIOA, 14, A);//SPCK pin
+	pio_setMux(PIOA, 13, A);//MOSI pin
+	pio_setMux(PIOA, 12, A);//MISO pin
+	pio_setMux(PIOA, 11, A);//NSS pin
+	
+	SPI->SPI_CR = SPI_CR_SPIDIS;
+	SPI->SPI_IDR = 0xFFFFFFFF;
+	SPI->SPI_PTCR = SPI_PTCR_TXTDIS | SPI_PTCR_RXTDIS;
+	SPI->SPI_MR = 0; // Slave mode, the slave always uses NPCS0 and CSR0
+	SPI->SPI_CSR[0] = SPI_CSR_BITS(SpiSettings.bits_per_transfer - 8);
+	spi_setMode(NPCS0, SpiSettings.spi_mode);
+	SPI->SPI_TDR = SpiSettings.idle_word; // Repeated for every word since it is never written again
+	
+	spi_slaveMode = true;
+	spi_slaveRing = SpiSettings.ring_buffer;
+	spi_slaveRingLength = SpiSettings.ring_length;
+	spi_slaveBlockLength = SpiSettings.block_length;
+	spi_slaveWordSize = word_size;
+	spi_slaveCurrentEnd = 0;
+	spi_slaveTotalEnd = 0;
+	spi_slaveArmedEnd = 0;
+	spi_slaveReadPosition = 0;
+	spi_slaveStatistics = (struct SpiSlaveStatistics){0};
+	
+	// Start stalled with an empty ring, so the service arms the first two blocks
+	SPI->SPI_RCR = 0;
+	SPI->SPI_RNCR = 0;
+	spi_slaveStalled = true;
+	spi_slaveService();
+	SPI->SPI_RDR; // Throw away anything left in the receive register
+	SPI->SPI_SR;
+	SPI->SPI_PTCR = SPI_PTCR_RXTEN;
+	SPI->SPI_IER = SPI_IER_ENDRX | SPI_IER_NSSR | SPI_IER_OVRES;
+	SPI->SPI_CR = SPI_CR_SPIEN;
+	NVIC_EnableIRQ(SPI_IRQn);
+}
@@ -3,12 +3,19 @@
 
 #include "sam.h"
 #include "../FreeRTOS/include/FreeRTOS.h"
-#include "../FreeRTOS/include/semphr.h"
+#include "../FreeRTOS/include/task.h"
 
 #include <stdbool.h>
 
-extern SemaphoreHandle_t spi_handlerIsDoneSempahore;
-extern SemaphoreHandle_t spi_mutex;
+/* Blocking transfers of at most this many words are polled instead of using the PDC, see spi_setPolledThreshold 
+and "Short transfers" below */
+#define SPI_DEFAULT_POLLED_THRESHOLD 4
+// Buckets of the wakeup latency histogram. Bucket i counts latencies below (SPI_LATENCY_BUCKET_CYCLES << i) 
+// cycles that did not fit in a lower bucket, the last bucket counts everything longer.
+#define SPI_LATENCY_BUCKETS 8
+#define SPI_LATENCY_BUCKET_CYCLES 256
+/* Number of times the readback has to pass at a clock divider for spi_calibrateClock to call it stable */
+#define SPI_CALIBRATION_PASSES 4
 
 enum SpiMode{
 	MODE_0, // CPOL 0 , NCPHA 1
@@ -52,15 +59,156 @@ struct SpiSlaveSettings {
 	If DLYBCT = 0, no delay is inserted. Look at page 818 for more information*/
 	uint8_t delay_between_two_consecutive_transfers;
 	};
+
+/* Settings for running the SPI as a slave to another processor, see "Slave mode" below */
+struct SpiSlave {
+	uint8_t NVIC_spi_interrupt_priority; // must be >= 5
+	/*Specify Mode 0..3. Must be the same as the master uses. */
+	enum SpiMode spi_mode;
+	/*Bits per transfer, 8..16. More than 8 bits are stored as uint16_t. */
+	uint8_t bits_per_transfer;
+	/* Ring buffer the PDC receives into. ring_length is in bytes and must be a power of two, a multiple 
+	of block_length, and at least two blocks. The PDC is given one block at a time. */
+	void *ring_buffer;
+	uint32_t ring_length;
+	uint32_t block_length;
+	/* Sent on MISO for every word received */
+	uint16_t idle_word;
+};
+
+struct SpiSlaveStatistics {
+	uint64_t bytes_received;
+	/* Number of times the ring was full, so the PDC had no block to receive into. Words were lost then. */
+	uint32_t stalls;
+	/* Number of times a received word was overwritten before the PDC read it (OVRES) */
+	uint32_t overruns;
+};
+
+/* How the words of a transfer are laid out in its buffers */
+enum SpiWordFormat {
+	/* uint32_t words made with spi_word, with the chip select in each word. Variable peripheral select. */
+	SPI_FORMAT_PDC_WORD = 0,
+	/* Plain uint8_t data for one chip select. Fixed peripheral select, 8 bits per transfer. */
+	SPI_FORMAT_PACKED_8,
+	/* Plain uint16_t data for one chip select. Fixed peripheral select, bits_per_transfer of 
+	the chip select if it is more than 8, otherwise 16. */
+	SPI_FORMAT_PACKED_16
+};
+
+enum SpiTransferStatus {
+	SPI_TRANSFER_PENDING = 0,
+	SPI_TRANSFER_DONE,
+	/* Done, but a received word was overwritten before the PDC could read it (OVRES) */
+	SPI_TRANSFER_OVERRUN
+};
+
+/* One piece of a scatter-gather transfer. The length is in words and has no upper limit, 
+segments longer than the PDC counters allow are split up by the driver. Must not be 0. 
+receive_buffer can be NULL for a segment that is only written. */
+struct SpiSegment {
+	void *transmit_buffer;
+	void *receive_buffer;
+	uint32_t length;
+	/* Number of times the segment is sent back to back, for streaming a pattern. 0 is the same as 1. 
+	A repeated segment should be write only, since every repetition is received into the same buffer. */
+	uint32_t repeat;
+};
+
+/* Descriptor for one transfer on the non-blocking interface. 
+The driver owns the descriptor from spi_submitTransfer until it is done, so the descriptor 
+and its buffers must stay valid (not on a stack frame that returns) until then. */
+struct SpiTransfer {
+	void *transmit_buffer;
+	void *receive_buffer;
+	/* Number of words in the transmit buffer. The receive buffer must be the same size, 
+	or NULL for a write only transfer. */
+	uint32_t buffer_length;
+	/* Scatter-gather list sent back to back as one transfer. When segments is not NULL 
+	the three fields above are not used. */
+	const struct SpiSegment *segments;
+	uint16_t segment_count;
+	/* Layout of the buffers. For the packed formats the transfer goes to chip_select, for 
+	SPI_FORMAT_PDC_WORD the chip select is taken from each word, and chip_select only tells 
+	the driver which device the transfer is for. */
+	enum SpiWordFormat format;
+	enum SpiChipSelect chip_select;
+	/* Called from SPI_Handler with user and the final status when the transfer is done. Set to NULL if not used. */
+	void (*callBackFunc)(void *user, enum SpiTransferStatus status);
+	void *user;
+	/* Task that gets a notification (vTaskNotifyGiveFromISR) when the transfer is done. Set to NULL if not used. */
+	TaskHandle_t notify_task;
+	
+	/* Used by the driver */
+	struct SpiTransfer *next;
+	volatile enum SpiTransferStatus status;
+	bool overrun;
+	uint16_t segment_index;
+	uint32_t segment_offset;
+	uint32_t segment_repeat;
+	uint32_t hold_remaining;
+	uint32_t submit_time;
+	uint32_t complete_time;
+};
 	
+/* Quality of service for the transfers to one chip select */
+struct SpiQos {
+	/* Waiting transfers with a higher priority are started first. Equal priorities take turns. */
+	uint8_t priority;
+	/* Longest run of words a transfer to this chip select may send before a waiting transfer with a 
+	higher priority is let in. The chip select is released when that happens, so only set this for 
+	devices that allow it. 0 = a transfer is never interrupted. */
+	uint32_t max_hold_words;
+};
+
+/* What the bus did for one chip select. Times are in CPU cycles (DWT CYCCNT). */
+struct SpiStatistics {
+	uint32_t transfers;
+	uint64_t words;
+	uint32_t preemptions; // Number of times a transfer to this chip select was interrupted for a more urgent one
+	/* Time from submit until the first word of a transfer is given to the PDC */
+	uint64_t total_wait_cycles;
+	uint32_t max_wait_cycles;
+	/* Time the bus was busy with this chip select, from starting a chunk until SPI_Handler saw it finished */
+	uint64_t busy_cycles;
+	/* Transfers waiting in the queue now, and the most there have been */
+	uint16_t queue_depth;
+	uint16_t max_queue_depth;
+	/* Time from SPI_Handler finishing a transfer until spi_waitForTransfer returns in the waiting task */
+	uint32_t wakeup_latency[SPI_LATENCY_BUCKETS];
+};
+
 void spi_masterInit(struct SpiMaster SpiSettings );
 void spi_chipSelectInit(struct SpiSlaveSettings SpiCsSettings);
+void spi_slaveInit(struct SpiSlave SpiSettings);
+uint32_t spi_slaveReceive(const void **data, TickType_t ticks_to_wait);
+void spi_slaveRelease(uint32_t length);
+void spi_slaveGetStatistics(struct SpiSlaveStatistics *statistics);
+// For tests: moves the ring positions of an empty ring on by count bytes, a multiple of ring_length
+void spi_slaveSkipPositions(uint32_t count);
 
+void spi_submitTransfer(struct SpiTransfer *transfer);
+void spi_submitTransferFromISR(struct SpiTransfer *transfer);
+bool spi_transferIsDone(struct SpiTransfer *transfer);
+enum SpiTransferStatus spi_waitForTransfer(struct SpiTransfer *transfer);
+void spi_setPolledThreshold(uint32_t max_words);
+void spi_setChipSelectQos(enum SpiChipSelect chip_select, struct SpiQos qos);
+void spi_getStatistics(enum SpiChipSelect chip_select, struct SpiStatistics *statistics);
+void spi_resetStatistics(void);
+void spi_setChipSelectCallback(enum SpiChipSelect chip_select, void (*callBackFunc)(void *user, enum SpiTransferStatus status), void *user);
 
-void spi_freeRTOSTranceive(uint32_t  *transmit_buffer, uint8_t buffer_length, void (*callBackFunc)(void), uint32_t *receive_buffer);
+void spi_freeRTOSTranceive(uint32_t  *transmit_buffer, uint32_t buffer_length, void (*callBackFunc)(void), uint32_t *receive_buffer);
+void spi_freeRTOSTranceiveSegments(const struct SpiSegment *segments, uint16_t segment_count);
+void spi_freeRTOSTranceivePacked(enum SpiChipSelect chip_select, enum SpiWordFormat format, void *transmit_buffer, uint32_t buffer_length, void *receive_buffer);
+void spi_freeRTOSTranceiveSequence(enum SpiChipSelect chip_select, enum SpiWordFormat format, const struct SpiSegment *segments, 
+	uint16_t segment_count, void (*beforeSegment)(void *user, uint16_t segment_index), void *user);
 uint32_t spi_word(bool last_xfer, uint8_t chip_select, uint16_t data);
+void spi_encodeWords8(uint32_t *words, const uint8_t *data, uint32_t length, uint8_t chip_select, uint16_t flags, bool last_xfer);
+void spi_encodeWords16(uint32_t *words, const uint16_t *data, uint32_t length, uint8_t chip_select, uint16_t flags, bool last_xfer);
 
 void spi_setBaudRateHz(uint32_t peripheral_clock_hz, uint32_t baud_rate_hz, uint8_t chip_select);
+void spi_setClockDivider(enum SpiChipSelect chip_select, uint8_t divider);
+uint8_t spi_getClockDivider(enum SpiChipSelect chip_select);
+uint8_t spi_calibrateClock(enum SpiChipSelect chip_select, uint8_t slowest_divider, uint8_t margin_steps, bool (*readback)(void *user), void *user);
 
 
 /*
@@ -114,18 +262,236 @@ uint32_t rbuffer[3] = {0};
 	
 There is a function included with the driver called spi_word which will create the words in the buffer for you:
 uint32_t tbuffer[3] = { spi_word(false, CS = 2, data1) , spi_word(false, CS = 2, data2), spi_word(true, CS = 2, data3)};
+
+To fill a buffer from a whole payload use spi_encodeWords8 or spi_encodeWords16 instead. They write one word 
+per element with flags ORed into the data field (like the D/C bit of a 9-bit display), and LASTXFER only on 
+the last word if last_xfer is set. The chip select is looked up once and the loop is unrolled, so this is 
+faster than calling spi_word for every element (Tests/bench_spi_encode compares the two):
+
+	static const uint8_t parameters[4] = {0x00, 0x00, 0x00, 0xEF};
+	spi_encodeWords8(&tbuffer[1], parameters, 4, NPCS1, 0x100, false);
 	
 The received data will be the 8-16 LSB bits in the receive buffer index corresponding to the transmit buffer index.
 
+Packed buffers:
+
+Every spi_word costs 32 bits of RAM and a 32-bit PDC access, whatever the word length is. For traffic to 
+a single chip select the data can instead be given as plain uint8_t or uint16_t buffers by setting the 
+format of the transfer to SPI_FORMAT_PACKED_8 or SPI_FORMAT_PACKED_16 and chip_select to the device. 
+The driver then switches SPI_MR to fixed peripheral select for that transfer, and back to variable 
+peripheral select for the next SPI_FORMAT_PDC_WORD transfer. The chip select is released when the 
+transfer is done. Transfers are only chained in the PDC behind transfers with the same format and 
+chip select, so the bus idles for a moment when switching.
+
+	uint8_t command[4] = {0x9F, 0, 0, 0}; // JEDEC ID
+	uint8_t answer[4];
+	spi_freeRTOSTranceivePacked(NPCS2, SPI_FORMAT_PACKED_8, command, 4, answer);
+
+Short transfers:
+
+For a transfer of one or a few words the PDC setup, the interrupt and the two task switches take longer 
+than the transfer itself. The blocking functions (spi_freeRTOSTranceive and spi_freeRTOSTranceivePacked) 
+therefore send transfers of at most SPI_DEFAULT_POLLED_THRESHOLD words by writing SPI_TDR and spinning 
+on TDRE (and RDRF if something is read), if the bus is free and the transfer has no callback. If the bus is busy they are queued as usual, so the order of the 
+transfers is kept. The threshold can be changed with spi_setPolledThreshold; 0 turns polling off.
+
+A polled transfer keeps the CPU spinning and the bus locked against the other chip selects for all of 
+its words, at 1 MHz about 9 us per 9-bit word, so the default is kept small. Where the crossover lies 
+depends on the SPI clock, the CPU clock and the interrupt and task switch costs of the system, so tune the 
+threshold on the target: Tests/bench_spi_polled times blocking transfers of 1 to 64 words both ways with 
+DWT->CYCCNT and only uses the driver, so its loop can be run in a task on the board. On the host it runs 
+against a register model that charges register accesses, interrupts and task wakeups but no instructions, 
+which makes polling look much cheaper than it is; its numbers there only show that the benchmark works.
+
+A device that needs a pin changed between parts of a transfer, like the D/C line of a 4-wire display 
+between a command and its parameters, can send them with spi_freeRTOSTranceiveSequence. beforeSegment 
+is called before every segment, once the one before it is off the bus. If no segment is longer than 
+the threshold, the whole sequence is polled in one go; otherwise every segment is a blocking transfer 
+of its own. With beforeSegment NULL the segments go out back to back.
+
+	static void setDataOrCommand(void *user, uint16_t segment_index) {
+		pio_setOutput(PIOA, 22, (segment_index == 0) ? PIN_LOW : PIN_HIGH);
+	}
+	uint8_t command = 0x2A; // Column address set
+	uint8_t columns[4] = {0, 0, 0, 239};
+	struct SpiSegment segments[2] = {{ .transmit_buffer = &command, .length = 1 }, { .transmit_buffer = columns, .length = 4 }};
+	spi_freeRTOSTranceiveSequence(NPCS1, SPI_FORMAT_PACKED_8, segments, 2, setDataOrCommand, NULL);
+
+Buffers can be of any length. The PDC counters are 16 bits, so the driver gives long buffers to the 
+PDC in pieces and reloads it from SPI_Handler. Data that is spread over several buffers can be sent as 
+one transfer with a scatter-gather list, which is walked by SPI_Handler without a gap between the buffers:
+
+	struct SpiSegment segments[2] = {
+		{ .transmit_buffer = header,  .receive_buffer = rheader,  .length = 11 },
+		{ .transmit_buffer = payload, .receive_buffer = rpayload, .length = 4000 }
+	};
+	spi_freeRTOSTranceiveSegments(segments, 2);
+
+A segment with repeat set is sent that many times in a row, which streams a pattern of any length from 
+a small buffer. To fill a display with one colour, encode a few hundred pixels once and repeat them:
+
+	struct SpiSegment fill[2] = {
+		{ .transmit_buffer = window, .receive_buffer = NULL, .length = 11 },
+		{ .transmit_buffer = pixels, .receive_buffer = NULL, .length = 480, .repeat = 320 }
+	};
+
+
+Non-blocking transfers:
+
+spi_freeRTOSTranceive blocks the calling task until its buffer has been sent. Its callBackFunc, if not NULL, 
+is called from SPI_Handler when the transfer is done, before the task is woken, as it always has been. 
+The transfer is queued, limited by spi_setChipSelectQos and counted in the statistics under the chip select 
+in the PCS field of its first word, and so is a spi_freeRTOSTranceiveSegments transfer, so it keeps its 
+order with the transfers submitted to the same device. 
+A task that has other work 
+to do while the bus is busy can instead fill in a struct SpiTransfer and give it to spi_submitTransfer. 
+Submitted transfers are queued, and SPI_Handler starts the next one in the queue as soon as the 
+previous one is done, so the bus is kept busy as long as there is something in the queue. 
+The transfer after the one in progress is preloaded into the PDC next pointer/counter registers 
+(TNPR/TNCR and RNPR/RNCR), so the PDC rolls from one buffer to the next without waiting for the 
+interrupt. To stream a large update, split it into a few buffers and keep at least two of them 
+submitted; refill a buffer from its completion and submit it again. 
+When a transfer is done the driver sets transfer->status, calls callBackFunc(user, status) from the 
+interrupt and gives notify_task a task notification. Example:
+
+	static uint32_t tbuffer[64], rbuffer[64];
+	static struct SpiTransfer frame = {
+		.transmit_buffer = tbuffer,
+		.receive_buffer = rbuffer,
+		.buffer_length = 64,
+	};
+	frame.notify_task = xTaskGetCurrentTaskHandle();
+	spi_submitTransfer(&frame);
+	// ... compute the next frame ...
+	spi_waitForTransfer(&frame);
+
+Sharing the bus:
+
+There is one queue per chip select. When the bus is free the driver takes the next transfer from the 
+chip select with the highest priority, and chip selects with the same priority take turns. The order of 
+the transfers is kept within each chip select, but not between chip selects. By default all chip selects 
+have priority 0 and a transfer keeps the bus until it is done. A latency critical device can be given a 
+higher priority, and a device with long transfers a maximum hold time, with spi_setChipSelectQos:
+
+	spi_setChipSelectQos(NPCS1, (struct SpiQos){ .priority = 0, .max_hold_words = 512 }); // display
+	spi_setChipSelectQos(NPCS2, (struct SpiQos){ .priority = 2, .max_hold_words = 0 });   // sensor
+
+A display transfer is then given to the PDC 512 words at a time, and a waiting sensor transfer is started 
+as soon as the display has finished the piece on the bus and the piece preloaded behind it. spi_getStatistics tells how long 
+the transfers to a chip select have waited for the bus, which can be used to tune these settings.
+
+Statistics:
+
+The driver counts, per chip select, the transfers and words sent, how long transfers waited in the queue, 
+how long the bus was busy, how deep the queue got, and a histogram of how long it took a waiting task to 
+wake up after its transfer was done. It is a handful of additions per chunk, so it is always on. 
+spi_getStatistics copies the numbers for a chip select, and spi_resetStatistics starts them over:
+
+	struct SpiStatistics display;
+	spi_getStatistics(NPCS1, &display);
+	// Share of the bus used by the display since the reset
+	uint32_t percent = (display.busy_cycles * 100) / (DWT->CYCCNT - reset_time);
+
+The cycle counter wraps after 2^32 cycles, so a single wait or wakeup is only measured right if it is 
+shorter than that (about 35 seconds at 120 MHz).
+
+Write only transfers:
+
+Most display traffic has nothing to read back. If receive_buffer is NULL the driver only runs the PDC 
+transmit channel, so no receive buffer is needed and the PDC does half the memory accesses. The words 
+received meanwhile are thrown away (they overrun in SPI_RDR, which is not reported). When a write only 
+transfer is the last one on the bus it is done when TXEMPTY says the last word has left the shift register. 
+When another write only transfer follows right behind it, it is done when the PDC has read its last word, 
+so its buffer can be refilled while the last words are still going out. Write only and read/write 
+transfers are not chained in the PDC, so the bus idles for a moment when switching between them.
+
+	spi_freeRTOSTranceive(tbuffer, 64, NULL, NULL);
+
+Coalescing:
+
+Transfers that are queued back to back for the same chip select, in the same format, and whose buffers 
+follow each other in memory (the transmit and receive buffers of the second start right after those of 
+the first) are given to the PDC as one run, which saves an interrupt per transfer. Each transfer is still 
+signalled on its own when the run is done. The driver never writes to the buffers, so spi_word transfers 
+are only merged after one whose last word has no LASTXFER; one that ends with LASTXFER releases the chip 
+select and ends the run.
+
+Clock calibration:
+
+The SPI clock of a chip select is the peripheral clock divided by SCBR (1 to 255). spi_setBaudRateHz picks 
+the divider from a rate, but how fast a device really works depends on the board. spi_calibrateClock finds 
+it at run time: starting at slowest_divider, which must be a divider the device is known to work at, it 
+lowers the divider one step at a time and calls readback SPI_CALIBRATION_PASSES times at each step. The 
+readback does a transfer to the device whose answer is known, like an ID read, and returns true if the 
+answer was right. The search stops at the first divider where a readback fails. The divider that is kept 
+is the fastest that passed plus margin_steps, and is also returned. If the device does not answer right 
+even at slowest_divider, the divider the chip select had before is put back and 0 is returned.
+
+	static bool flash_checkId(void *user) {
+		uint8_t command[4] = {0x9F, 0, 0, 0}; // JEDEC ID
+		uint8_t answer[4];
+		spi_freeRTOSTranceivePacked(NPCS2, SPI_FORMAT_PACKED_8, command, 4, answer);
+		return (answer[1] == 0xEF) && (answer[2] == 0x40) && (answer[3] == 0x18);
+	}
+	uint8_t divider = spi_calibrateClock(NPCS2, 60, 2, flash_checkId, NULL);
+
+Calibrate from a task before the chip select is used by anything else, since the divider changes under 
+any transfer to it that is in flight.
+
+Slave mode:
+
+spi_slaveInit sets the SPI up as a slave instead of a master, with NPCS0 (PA11) as the slave select input. 
+The master and slave modes can not be used at the same time. Everything the master sends is received by the 
+PDC into the ring buffer one block at a time. The next block is preloaded in the PDC next registers, so no 
+word is lost between blocks while SPI_Handler rearms them.
+
+spi_slaveReceive hands out the received data without copying it. It returns a pointer into the ring and the 
+number of bytes that follow it contiguously, waiting up to ticks_to_wait for data if there is none. It wakes 
+up when a block is full and when the master releases the slave select. The bytes stay valid until they are 
+given back with spi_slaveRelease, which makes room in the ring for the PDC again. If the reader falls more 
+than the ring behind, the PDC stops and words are lost until there is room for a block (counted as stalls). 
+The first word after the stop waits in RDR, every later one overwrites it (counted as overruns).
+
+	static uint8_t ring[4096];
+	struct SpiSlave slave = {
+		.NVIC_spi_interrupt_priority = 10,
+		.spi_mode = MODE_0,
+		.bits_per_transfer = 8,
+		.ring_buffer = ring,
+		.ring_length = sizeof(ring),
+		.block_length = 512
+	};
+	spi_slaveInit(slave);
+	while (1) {
+		const void *data;
+		uint32_t length = spi_slaveReceive(&data, portMAX_DELAY);
+		parse(data, length);
+		spi_slaveRelease(length);
+	}
+
+Only one task may read from the ring. The slave only receives, MISO sends idle_word for every word.
+
+Callbacks:
 
-To use this driver you must create the binary sempahore and the mutex. These are declared extern for this purpose. This can be done before the schedueler starts. For example in main as follows:
-spi_handlerIsDoneSempahore = xSemaphoreCreateBinary();
-spi_mutex = xSemaphoreCreateMutex();
+The callback of a transfer is called with its own user pointer, so several transfers in flight can share 
+one callback function. A callback can also be registered for a chip select with spi_setChipSelectCallback; 
+it is called for every transfer whose chip_select field is that chip select, after the transfer's own 
+callback. Both run in SPI_Handler, and may queue more work for the bus with spi_submitTransferFromISR 
+without waking a task:
 
-Both binary sempahores and mutexes in freeRTOS are created so that the first call to semaphoretake will pass. This is unwanted behaviour for us
-since we want the spi_handlerIsDoneSempahore to be given from the SPI_Handler the first time. 
+	static void display_rowDone(void *user, enum SpiTransferStatus status) {
+		struct Row *row = user;
+		if (encode_nextRow(row)) { // Refill the buffer that was just sent
+			spi_submitTransferFromISR(&row->transfer);
+		}
+	}
 
-The solution is to call xSemaphoreTake(spi_handlerIsDoneSempahore,0); in some task before the first spi transmission.
+No semaphores or mutexes have to be created to use this driver. The transfer queue serializes access 
+to the bus, and tasks waiting for a transfer are woken with task notifications.
+The SPI_Handler only touches the registers through the SPI pointer, so the driver can be compiled for 
+a host with SPI pointing to a register stand-in, and SPI_Handler called whenever the stand-in 
+sets a status bit that is enabled in SPI_IMR. Tests/Makefile builds it that way against the model 
+in Tests/host, and runs the tests in Tests with "make test".
 */
 
 #endif /* SPI_H_ */
\ No newline at end of file
@@ -0,0 +1,34 @@
+#include "host.h"
+#include "scenes.h"
+#include "ili9341.h"
+#include "ili9341_emulator.h"
+
+#include <stdio.h>
+
+// Bus words and time per frame for the scenes of the golden image test, as the panel emulator counts
+// them, at 25 MHz. Pixels written against words shows what the window setup of each primitive costs.
+
+static struct Ili9341Emulator panel;
+
+static void bench(void) {
+	host_initDisplay(&panel);
+	ili9341_init();
+	printf("scene         words  commands  parameters   pixels   read   us at 25 MHz\n");
+	for (uint32_t i = 0; i < host_sceneCount; i++) {
+		const struct HostScene *scene = &host_scenes[i];
+		struct Ili9341EmulatorFrame frame;
+		host_resetScene();
+		ili9341_emulatorEndFrame(&panel, &frame);
+		uint64_t start = host_time();
+		scene->draw();
+		host_idle();
+		uint64_t cycles = host_time() - start;
+		ili9341_emulatorEndFrame(&panel, &frame);
+		printf("%-10s %8u  %8u  %10u  %7u  %5u   %8.0f\n", scene->name, frame.words, frame.commands,
+			frame.parameters, frame.pixels_written, frame.pixels_read, (double)cycles / 100);
+	}
+}
+
+int main(void) {
+	return host_main(bench);
+}
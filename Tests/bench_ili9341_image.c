@@ -0,0 +1,80 @@
+#include "host.h"
+#include "ili9341.h"
+#include "ili9341_image.h"
+#include "ili9341_emulator.h"
+
+#include <stdio.h>
+#include <time.h>
+
+// ili9341_drawImage of images/splash.ppm against ili9341_writeRect of the same pixels from RAM. The SPI
+// time comes from the model at 25 MHz; the CPU time is that of the host, for the drivers and the model
+// together. Both have to leave the same picture on the panel.
+
+#define REPEATS	20
+#define X	60
+#define Y	100
+
+extern const struct Ili9341Image splash;
+
+static struct Ili9341Emulator panel;
+static uint16_t pixels[ILI9341_TFTWIDTH * ILI9341_TFTHEIGHT];
+
+static uint64_t nanoseconds(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+static void checkPicture(void) {
+	for (uint16_t y = 0; y < splash.height; y++) {
+		for (uint16_t x = 0; x < splash.width; x++) {
+			HOST_CHECK(ili9341_emulatorShownPixel(&panel, X + x, Y + y) == pixels[y * splash.width + x]);
+		}
+	}
+}
+
+static void report(const char *name, uint64_t cycles, uint64_t ns, uint64_t words, uint32_t bytes) {
+	printf("  %-10s %6.0f us on the bus, %6.0f words, host %7.0f ns, %6u bytes of image\n", name,
+		(double)cycles / REPEATS / 100, (double)words / REPEATS, (double)ns / REPEATS, bytes);
+}
+
+static void bench(void) {
+	host_initDisplay(&panel);
+	ili9341_init();
+	ili9341_fillScreen(0);
+	HOST_CHECK(ili9341_drawImage(X, Y, &splash));
+	host_idle();
+	for (uint16_t y = 0; y < splash.height; y++) {
+		for (uint16_t x = 0; x < splash.width; x++) {
+			pixels[y * splash.width + x] = ili9341_emulatorShownPixel(&panel, X + x, Y + y);
+		}
+	}
+	printf("%ux%u image, 25 MHz\n", splash.width, splash.height);
+
+	uint64_t words = host_counters.words;
+	uint64_t start_cycles = host_time();
+	uint64_t start_ns = nanoseconds();
+	for (uint32_t i = 0; i < REPEATS; i++) {
+		ili9341_drawImage(X, Y, &splash);
+	}
+	host_idle();
+	report("drawImage", host_time() - start_cycles, nanoseconds() - start_ns, host_counters.words - words, splash.length);
+	checkPicture();
+
+	ili9341_fillScreen(0);
+	host_idle();
+	words = host_counters.words;
+	start_cycles = host_time();
+	start_ns = nanoseconds();
+	for (uint32_t i = 0; i < REPEATS; i++) {
+		ili9341_writeRect(X, Y, splash.width, splash.height, pixels);
+	}
+	host_idle();
+	report("writeRect", host_time() - start_cycles, nanoseconds() - start_ns, host_counters.words - words,
+		2u * splash.width * splash.height);
+	checkPicture();
+}
+
+int main(void) {
+	return host_main(bench);
+}
@@ -0,0 +1,72 @@
+#include "host.h"
+#include "ili9341.h"
+#include "ili9341_text.h"
+#include "ili9341_emulator.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// Characters per second of ili9341_drawText with the glyph cache and without it, for a screen of
+// telemetry text. The SPI time comes from the model at 25 MHz; the CPU time is that of the host, for
+// the renderer and the model together, so only the difference between the two is the renderer's.
+// Build with -DILI9341_GLYPH_CACHE_ENTRIES=<n> (CFLAGS) to try other cache sizes.
+
+#define SCREENS	5
+
+static struct Ili9341Emulator panel;
+
+static const char *lines[4] = {
+	"T1 23.5C  T2 24.1C  T3 22.9C  T4 25.0C ",
+	"V  12.04V  I  0.51A  P  6.14W  E 102Wh ",
+	"RPM 1450  DUTY 37%  FAULT 0  STATE RUN ",
+	"UP 0012:45:09  LOG 00231  LINK OK  CH 3"
+};
+
+static uint64_t nanoseconds(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+static void drawScreens(bool cached, const char *name) {
+	const struct Ili9341Font *font = &ili9341_font6x8;
+	uint32_t rows = ILI9341_TFTHEIGHT / font->height;
+	uint32_t characters = 0;
+	ili9341_clearGlyphCache();
+	ili9341_setGlyphCacheEnabled(cached);
+	host_idle();
+	uint64_t start_cycles = host_time();
+	uint64_t start_ns = nanoseconds();
+	for (uint32_t screen = 0; screen < SCREENS; screen++) {
+		for (uint32_t row = 0; row < rows; row++) {
+			const char *text = lines[(row + screen) % 4];
+			ili9341_drawText(0, row * font->height, text, font, 0xFFFF, 0x0000);
+			characters += strlen(text);
+		}
+	}
+	host_idle();
+	uint64_t cycles = host_time() - start_cycles;
+	uint64_t ns = nanoseconds() - start_ns;
+	printf("  %-9s %7.0f chars/s on the bus, host %6.0f ns/char\n", name,
+		(double)characters * 100000000 / cycles, (double)ns / characters);
+}
+
+static void bench(void) {
+	host_initDisplay(&panel);
+	ili9341_init();
+	printf("%u screens of 6x8 text, 25 MHz, %u cache entries\n", SCREENS, ILI9341_GLYPH_CACHE_ENTRIES);
+	struct Ili9341GlyphCacheStatistics before;
+	struct Ili9341GlyphCacheStatistics after;
+	ili9341_getGlyphCacheStatistics(&before);
+	drawScreens(false, "uncached");
+	ili9341_getGlyphCacheStatistics(&after);
+	HOST_CHECK((after.hits == before.hits) && (after.misses == before.misses));
+	drawScreens(true, "cached");
+	ili9341_getGlyphCacheStatistics(&before);
+	printf("  cache hits %u, misses %u\n", before.hits - after.hits, before.misses - after.misses);
+}
+
+int main(void) {
+	return host_main(bench);
+}
@@ -0,0 +1,78 @@
+#include "host.h"
+#include "spi.h"
+
+#include <stdio.h>
+#include <time.h>
+
+// Filling a buffer of PDC words with spi_encodeWords8/16 against a spi_word call per element. This runs
+// on the host CPU, so it compares the two loops and not their speed on the SAM4N.
+
+#define LENGTH	500
+#define ROUNDS	20000
+#define DATA_BIT	0x100
+
+static uint8_t bytes[LENGTH];
+static uint16_t halfwords[LENGTH];
+static uint32_t encoded[LENGTH];
+static uint32_t expected[LENGTH];
+
+static uint64_t nanoseconds(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+static void report(const char *name, uint64_t loop_ns, uint64_t encoder_ns) {
+	printf("  %-18s spi_word %6.2f ns/word, encoder %6.2f ns/word, %.1fx\n", name,
+		(double)loop_ns / ROUNDS / LENGTH, (double)encoder_ns / ROUNDS / LENGTH, (double)loop_ns / encoder_ns);
+}
+
+static void bench(void) {
+	for (uint32_t i = 0; i < LENGTH; i++) {
+		bytes[i] = i * 7;
+		halfwords[i] = i * 7 + 1;
+	}
+	printf("%u words, %u rounds\n", LENGTH, ROUNDS);
+
+	uint64_t start = nanoseconds();
+	for (uint32_t round = 0; round < ROUNDS; round++) {
+		for (uint32_t i = 0; i < LENGTH; i++) {
+			expected[i] = spi_word(i == LENGTH - 1, NPCS1, DATA_BIT | bytes[i]);
+		}
+		__asm__ volatile("" : : "r"(expected) : "memory");
+	}
+	uint64_t loop_ns = nanoseconds() - start;
+	start = nanoseconds();
+	for (uint32_t round = 0; round < ROUNDS; round++) {
+		spi_encodeWords8(encoded, bytes, LENGTH, NPCS1, DATA_BIT, true);
+		__asm__ volatile("" : : "r"(encoded) : "memory");
+	}
+	uint64_t encoder_ns = nanoseconds() - start;
+	for (uint32_t i = 0; i < LENGTH; i++) {
+		HOST_CHECK(encoded[i] == expected[i]);
+	}
+	report("spi_encodeWords8", loop_ns, encoder_ns);
+
+	start = nanoseconds();
+	for (uint32_t round = 0; round < ROUNDS; round++) {
+		for (uint32_t i = 0; i < LENGTH; i++) {
+			expected[i] = spi_word(i == LENGTH - 1, NPCS1, halfwords[i]);
+		}
+		__asm__ volatile("" : : "r"(expected) : "memory");
+	}
+	loop_ns = nanoseconds() - start;
+	start = nanoseconds();
+	for (uint32_t round = 0; round < ROUNDS; round++) {
+		spi_encodeWords16(encoded, halfwords, LENGTH, NPCS1, 0, true);
+		__asm__ volatile("" : : "r"(encoded) : "memory");
+	}
+	encoder_ns = nanoseconds() - start;
+	for (uint32_t i = 0; i < LENGTH; i++) {
+		HOST_CHECK(encoded[i] == expected[i]);
+	}
+	report("spi_encodeWords16", loop_ns, encoder_ns);
+}
+
+int main(void) {
+	return host_main(bench);
+}
@@ -0,0 +1,64 @@
+#include "host.h"
+#include "spi.h"
+
+#include <stdio.h>
+
+// Blocking transfers of 1 to 64 words, polled and through the PDC, at a few SPI clocks. Prints the 
+// transfers per second of both paths for 1, 4, 16 and 64 words, and the longest transfer for which 
+// polling is still faster. The loop only uses the driver and DWT->CYCCNT, so it is meant to be run in
+// a task on the board to tune spi_setPolledThreshold. On the host the register model charges no
+// instructions, so polling comes out far too cheap and the numbers are not a basis for the default.
+
+#define MCK_HZ	100000000
+#define REPEATS	50
+#define MAX_WORDS	64
+
+static uint32_t words[MAX_WORDS];
+static uint32_t answer[MAX_WORDS];
+
+// Cycles per transfer of length words, with the given polled threshold
+static uint32_t measure(uint32_t length, uint32_t threshold) {
+	spi_setPolledThreshold(threshold);
+	uint32_t start = DWT->CYCCNT;
+	for (uint32_t i = 0; i < REPEATS; i++) {
+		spi_freeRTOSTranceive(words, length, NULL, answer);
+	}
+	return (DWT->CYCCNT - start) / REPEATS;
+}
+
+static void benchmark(uint32_t baud_rate_hz) {
+	spi_chipSelectInit((struct SpiSlaveSettings){ .chip_select = NPCS1, .peripheral_clock_hz = MCK_HZ, 
+		.spi_mode = MODE_0, .spi_baudRate_hz = baud_rate_hz, .bits_per_transfer = 9 });
+	printf("%u MHz, 9-bit words\n", baud_rate_hz / 1000000);
+	printf("  words  polled/s      pdc/s\n");
+	uint32_t crossover = 0;
+	for (uint32_t length = 1; length <= MAX_WORDS; length++) {
+		uint32_t polled = measure(length, MAX_WORDS);
+		uint32_t pdc = measure(length, 0);
+		if ((polled < pdc) && (crossover == length - 1)) {
+			crossover = length;
+		}
+		if ((length == 1) || (length == 4) || (length == 16) || (length == 64)) {
+			printf("  %5u  %8u  %9u\n", length, MCK_HZ / polled, MCK_HZ / pdc);
+		}
+	}
+	printf("  polling is faster up to %u words\n", crossover);
+}
+
+static void test(void) {
+	spi_masterInit((struct SpiMaster){ .NVIC_spi_interrupt_priority = 10, .cs_1 = PA31 });
+	printf("host model, no instruction costs: register access %u cycles, interrupt entry and exit %u, task wakeup %u, MCK %u MHz\n",
+		host_timing.access_cycles, host_timing.interrupt_cycles, host_timing.switch_cycles, MCK_HZ / 1000000);
+	for (uint32_t i = 0; i < MAX_WORDS; i++) {
+		words[i] = spi_word(i == MAX_WORDS - 1, NPCS1, i);
+	}
+	benchmark(50000000);
+	benchmark(25000000);
+	benchmark(12500000);
+	benchmark(1000000);
+	spi_setPolledThreshold(SPI_DEFAULT_POLLED_THRESHOLD);
+}
+
+int main(void) {
+	return host_main(test);
+}
@@ -0,0 +1,47 @@
+#ifndef FREERTOS_HOST_H_
+#define FREERTOS_HOST_H_
+
+// Host stand-in for the FreeRTOS calls the drivers use, for a single task. It is included on the 
+// command line ahead of every source, and takes the include guards of FreeRTOS.h and task.h so that 
+// the drivers' own includes of the real headers are empty.
+#define INC_FREERTOS_H
+#define INC_TASK_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+typedef uint32_t TickType_t;
+typedef void *TaskHandle_t;
+
+#define pdFALSE	((BaseType_t)0)
+#define pdTRUE	((BaseType_t)1)
+#define pdPASS	pdTRUE
+#define portMAX_DELAY	((TickType_t)0xffffffffUL)
+#define portTICK_PERIOD_MS	((TickType_t)1)
+#define portTICK_RATE_MS	portTICK_PERIOD_MS
+
+void host_fail(const char *file, int line, const char *expression);
+#define configASSERT(x)	do { if (!(x)) { host_fail(__FILE__, __LINE__, #x); } } while (0)
+
+void host_enterCritical(void);
+void host_exitCritical(void);
+#define taskENTER_CRITICAL()	host_enterCritical()
+#define taskEXIT_CRITICAL()	host_exitCritical()
+// Interrupt handlers are not interrupted on the host
+#define taskENTER_CRITICAL_FROM_ISR()	0
+#define taskEXIT_CRITICAL_FROM_ISR(x)	((void)(x))
+#define portEND_SWITCHING_ISR(x)	((void)(x))
+#define portYIELD_FROM_ISR(x)	((void)(x))
+#define taskYIELD()
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *higherPriorityTaskWoken);
+uint32_t ulTaskNotifyTake(BaseType_t clearCountOnExit, TickType_t ticksToWait);
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount(void);
+TickType_t xTaskGetTickCountFromISR(void);
+
+#endif /* FREERTOS_HOST_H_ */
@@ -0,0 +1,740 @@
+#include "host.h"
+#include "ili9341_emulator.h"
+#include "spi.h"
+#include "pio.h"
+#include "pmc.h"
+#include "delay.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+
+void SPI_Handler(void);
+
+// SPI_TDR holds this while nothing has been written to it. No real word has bits 25 to 31 set.
+#define TDR_EMPTY	0xFFFFFFFFu
+// How often the model looks at the registers while nothing happens on the bus
+#define IDLE_CYCLES	256
+// A task waiting longer than this for a notification is taken to hang (10 s at 100 MHz)
+#define HANG_CYCLES	1000000000ull
+#define STACK_SIZE	(16u << 20)
+#define DATA_COMMAND_PIN	22
+
+struct HostTiming host_timing = {
+	.access_cycles = 2,
+	.interrupt_cycles = 24,
+	.interrupt_latency_cycles = 0,
+	.switch_cycles = 300,
+	.master_word_cycles = 64
+};
+struct HostCounters host_counters;
+struct HostWord host_wire[HOST_WIRE_LENGTH];
+uint32_t host_wireLength;
+bool host_wireOverflow;
+uint32_t (*host_miso)(uint32_t word);
+
+Pio host_pio[3];
+DWT_Type host_dwt;
+CoreDebug_Type host_coreDebug;
+
+static Spi registers;
+static uint64_t now;
+static uint64_t next_event; // The model has nothing to do before this
+static int critical_nesting;
+static bool in_interrupt;
+static uint64_t frozen_cycles; // Spent in an interrupt handler or critical section, passed when it ends
+
+// State the SPI keeps apart from its registers
+static uint32_t interrupt_mask;
+static uint32_t transfer_status; // PTSR
+static uint32_t latched_status; // OVRES and NSSR
+static bool spi_enabled;
+static bool end_rx;
+static bool end_tx;
+static bool receive_full;
+
+static bool shifting;
+static struct HostWord shifter;
+static uint64_t shift_end;
+static bool selected; // A chip select is asserted
+static uint8_t selected_chip_select;
+
+static bool irq_enabled;
+static bool irq_pending;
+static bool irq_waiting; // An enabled status bit is set, since irq_raised
+static uint64_t irq_raised;
+
+static struct Ili9341Emulator *panel;
+static uint8_t panel_chip_select;
+
+static const uint32_t *master_words;
+static uint32_t master_count;
+static uint64_t master_next;
+
+static Pio *periodic_pio;
+static uint8_t periodic_pin;
+static uint32_t periodic_cycles;
+static uint64_t periodic_next;
+
+static uint32_t notifications;
+
+static ucontext_t main_context;
+static ucontext_t test_context;
+
+static void advance(uint64_t cycles);
+
+// Interrupt handlers and critical sections run in no time, and the time they took is let pass after them. 
+// The PDC is not moving meanwhile, so the model does not show races with the PDC inside them.
+static void thaw(uint64_t cycles) {
+	cycles += frozen_cycles;
+	frozen_cycles = 0;
+	advance(cycles);
+}
+
+void host_fail(const char *file, int line, const char *expression) {
+	printf("FAIL %s:%d: %s\n", file, line, expression);
+	printf("at cycle %llu: SR %08x IMR %08x PTSR %08x TCR %u TNCR %u RCR %u RNCR %u, %s, %s, %llu words\n", 
+		(unsigned long long)now, registers.SPI_SR, registers.SPI_IMR, registers.SPI_PTSR, registers.SPI_TCR, 
+		registers.SPI_TNCR, registers.SPI_RCR, registers.SPI_RNCR, spi_enabled ? "enabled" : "disabled", 
+		shifting ? "shifting" : "idle", (unsigned long long)host_counters.words);
+	exit(1);
+}
+
+static uint64_t earliest(uint64_t a, uint64_t b) {
+	return (a < b) ? a : b;
+}
+
+static void setClock(void) {
+	host_dwt.CYCCNT = (uint32_t)now;
+}
+
+static uint8_t chipSelectOf(uint32_t pcs) {
+	if (!(pcs & 1)) {
+		return 0;
+	}
+	if (!(pcs & 2)) {
+		return 1;
+	}
+	return !(pcs & 4) ? 2 : 3;
+}
+
+static uint8_t bitsOf(uint8_t chip_select) {
+	return ((registers.SPI_CSR[chip_select] & SPI_CSR_BITS_Msk) >> SPI_CSR_BITS_Pos) + 8;
+}
+
+// SPCK is MCK / SCBR, and DLYBCT adds 32 MCK cycles per step between words
+static uint32_t wordCycles(uint8_t chip_select) {
+	uint32_t divider = (registers.SPI_CSR[chip_select] & SPI_CSR_SCBR_Msk) >> SPI_CSR_SCBR_Pos;
+	uint32_t delay = (registers.SPI_CSR[chip_select] & SPI_CSR_DLYBCT_Msk) >> SPI_CSR_DLYBCT_Pos;
+	return bitsOf(chip_select) * ((divider == 0) ? 1 : divider) + 32 * delay;
+}
+
+static bool isMaster(void) {
+	return (registers.SPI_MR & SPI_MR_MSTR) != 0;
+}
+
+static uint8_t pdcWordSize(uint8_t chip_select) {
+	if (registers.SPI_MR & SPI_MR_PS) {
+		return 4;
+	}
+	return (bitsOf(chip_select) > 8) ? 2 : 1;
+}
+
+static bool transmitPending(void) {
+	return (transfer_status & SPI_PTSR_TXTEN) && (registers.SPI_TCR > 0);
+}
+
+static uint32_t status(void) {
+	uint32_t sr = latched_status;
+	if ((registers.SPI_RCR == 0) || end_rx) {
+		sr |= SPI_SR_ENDRX;
+	}
+	if ((registers.SPI_RCR == 0) && (registers.SPI_RNCR == 0)) {
+		sr |= SPI_SR_RXBUFF;
+	}
+	if ((registers.SPI_TCR == 0) || end_tx) {
+		sr |= SPI_SR_ENDTX;
+	}
+	if ((registers.SPI_TCR == 0) && (registers.SPI_TNCR == 0)) {
+		sr |= SPI_SR_TXBUFE;
+	}
+	if (registers.SPI_TDR == TDR_EMPTY) {
+		sr |= SPI_SR_TDRE;
+		if (!shifting && !(isMaster() && spi_enabled && transmitPending())) {
+			sr |= SPI_SR_TXEMPTY;
+		}
+	}
+	if (receive_full) {
+		sr |= SPI_SR_RDRF;
+	}
+	if (spi_enabled) {
+		sr |= SPI_SR_SPIENS;
+	}
+	return sr;
+}
+
+// The chip select goes high: at LASTXFER, when the bus runs dry (CSAAT is never set) and when the SPI is disabled
+static void deselect(void) {
+	if (selected && (panel != NULL) && (selected_chip_select == panel_chip_select)) {
+		ili9341_emulatorEndTransfer(panel);
+	}
+	selected = false;
+}
+
+// Takes in what the driver wrote to the write only registers since the last access, and updates the status
+static void sync(void) {
+	if (registers.SPI_IDR) {
+		interrupt_mask &= ~registers.SPI_IDR;
+		registers.SPI_IDR = 0;
+	}
+	if (registers.SPI_IER) {
+		interrupt_mask |= registers.SPI_IER;
+		registers.SPI_IER = 0;
+	}
+	*(uint32_t *)&registers.SPI_IMR = interrupt_mask;
+
+	uint32_t ptcr = registers.SPI_PTCR;
+	registers.SPI_PTCR = 0;
+	if (ptcr & SPI_PTCR_TXTDIS) {
+		transfer_status &= ~SPI_PTSR_TXTEN;
+	}
+	if (ptcr & SPI_PTCR_RXTDIS) {
+		transfer_status &= ~SPI_PTSR_RXTEN;
+	}
+	if (ptcr & SPI_PTCR_TXTEN) {
+		transfer_status |= SPI_PTSR_TXTEN;
+	}
+	if (ptcr & SPI_PTCR_RXTEN) {
+		transfer_status |= SPI_PTSR_RXTEN;
+		latched_status &= ~SPI_SR_OVRES;
+	}
+	*(uint32_t *)&registers.SPI_PTSR = transfer_status;
+
+	uint32_t cr = registers.SPI_CR;
+	registers.SPI_CR = 0;
+	if (cr & SPI_CR_SPIEN) {
+		spi_enabled = true;
+	}
+	if (cr & SPI_CR_SPIDIS) {
+		spi_enabled = false;
+		deselect();
+	}
+	if (cr & SPI_CR_LASTXFER) {
+		deselect();
+	}
+
+	uint32_t sr = status();
+	*(uint32_t *)&registers.SPI_SR = sr;
+
+	// Work for the model: a word to send, or an interrupt to take
+	bool active = irq_enabled && ((sr & interrupt_mask) || irq_pending);
+	if (active && !irq_waiting) {
+		irq_waiting = true;
+		irq_raised = now;
+	}
+	else if (!active) {
+		irq_waiting = false;
+	}
+	if (active || (!shifting && spi_enabled && isMaster() && ((registers.SPI_TDR != TDR_EMPTY) || transmitPending()))) {
+		next_event = earliest(next_event, now);
+	}
+}
+
+static uint32_t readMemory(uint32_t address, uint8_t size) {
+	switch (size) {
+		case 1:
+		return *(uint8_t *)(uintptr_t)address;
+		case 2:
+		return *(uint16_t *)(uintptr_t)address;
+		default:
+		return *(uint32_t *)(uintptr_t)address;
+	}
+}
+
+static void writeMemory(uint32_t address, uint8_t size, uint32_t value) {
+	switch (size) {
+		case 1:
+		*(uint8_t *)(uintptr_t)address = value;
+		break;
+		case 2:
+		*(uint16_t *)(uintptr_t)address = value;
+		break;
+		default:
+		*(uint32_t *)(uintptr_t)address = value;
+		break;
+	}
+}
+
+// The PDC receive channel takes the word, or it is left in SPI_RDR
+static void receive(uint32_t word, uint8_t size) {
+	if ((transfer_status & SPI_PTSR_RXTEN) && (registers.SPI_RCR > 0)) {
+		writeMemory(registers.SPI_RPR, size, word);
+		registers.SPI_RPR += size;
+		if (--registers.SPI_RCR == 0) {
+			end_rx = true;
+			if (registers.SPI_RNCR > 0) {
+				registers.SPI_RPR = registers.SPI_RNPR;
+				registers.SPI_RCR = registers.SPI_RNCR;
+				registers.SPI_RNCR = 0;
+			}
+		}
+		return;
+	}
+	if (receive_full) {
+		latched_status |= SPI_SR_OVRES;
+	}
+	receive_full = true;
+	*(uint32_t *)&registers.SPI_RDR = word;
+}
+
+static uint32_t panelWord(const struct HostWord *word) {
+	uint16_t data = word->data & SPI_TDR_TD_Msk;
+	switch (word->bits) {
+		case 9:
+		return ili9341_emulatorWord9(panel, data & 0x1FF);
+		case 8:
+		return ili9341_emulatorByte(panel, word->data_command, data & 0xFF);
+		default:
+		ili9341_emulatorPixel16(panel, data);
+		return 0;
+	}
+}
+
+// The word in the shift register is done
+static void completeWord(void) {
+	shifting = false;
+	host_counters.words++;
+	if (host_wireLength < HOST_WIRE_LENGTH) {
+		host_wire[host_wireLength++] = shifter;
+	}
+	else {
+		host_wireOverflow = true;
+	}
+
+	uint32_t answer;
+	if ((panel != NULL) && (shifter.chip_select == panel_chip_select)) {
+		answer = panelWord(&shifter);
+	}
+	else if (host_miso != NULL) {
+		answer = host_miso(shifter.data);
+	}
+	else {
+		answer = shifter.data & SPI_TDR_TD_Msk;
+	}
+	receive(answer, shifter.size);
+	if (shifter.last) {
+		deselect();
+	}
+}
+
+// Moves the next word into the shift register, from SPI_TDR or the PDC transmit channel
+static bool loadWord(uint64_t start) {
+	if (!spi_enabled || !isMaster()) {
+		return false;
+	}
+	uint32_t word;
+	uint8_t chip_select;
+	uint8_t size;
+	bool variable = (registers.SPI_MR & SPI_MR_PS) != 0;
+	if (registers.SPI_TDR != TDR_EMPTY) {
+		word = registers.SPI_TDR;
+		registers.SPI_TDR = TDR_EMPTY;
+		receive_full = false; // The driver reads SPI_RDR before it writes the next word
+		chip_select = chipSelectOf(variable ? (word >> 16) : (registers.SPI_MR >> SPI_MR_PCS_Pos));
+		size = pdcWordSize(chip_select);
+	}
+	else if (transmitPending()) {
+		uint32_t pcs = registers.SPI_MR >> SPI_MR_PCS_Pos;
+		if (variable) {
+			pcs = readMemory(registers.SPI_TPR, 4) >> 16;
+		}
+		chip_select = chipSelectOf(pcs);
+		size = pdcWordSize(chip_select);
+		word = readMemory(registers.SPI_TPR, size);
+		registers.SPI_TPR += size;
+		if (--registers.SPI_TCR == 0) {
+			end_tx = true;
+			if (registers.SPI_TNCR > 0) {
+				registers.SPI_TPR = registers.SPI_TNPR;
+				registers.SPI_TCR = registers.SPI_TNCR;
+				registers.SPI_TNCR = 0;
+			}
+		}
+	}
+	else {
+		return false;
+	}
+
+	if (selected && (selected_chip_select != chip_select)) {
+		deselect();
+	}
+	selected = true;
+	selected_chip_select = chip_select;
+	shifter = (struct HostWord){
+		.data = word,
+		.chip_select = chip_select,
+		.bits = bitsOf(chip_select),
+		.size = size,
+		.data_command = (host_pio[0].level >> DATA_COMMAND_PIN) & 1,
+		.last = variable && (word & SPI_TDR_LASTXFER)
+	};
+	shifting = true;
+	shift_end = start + wordCycles(chip_select);
+	return true;
+}
+
+static void receiveFromMaster(void) {
+	if (spi_enabled && !isMaster()) {
+		uint8_t size = (bitsOf(0) > 8) ? 2 : 1;
+		receive(*master_words, size);
+	}
+	master_words++;
+	if (--master_count == 0) {
+		latched_status |= SPI_SR_NSSR;
+	}
+}
+
+static void takeInterrupts(void) {
+	if ((critical_nesting > 0) || in_interrupt) {
+		return;
+	}
+	if ((periodic_cycles != 0) && (now >= periodic_next)) {
+		periodic_next += periodic_cycles;
+		host_pinInterrupt(periodic_pio, periodic_pin);
+	}
+	sync();
+	if (!irq_waiting) {
+		return;
+	}
+	if (now < irq_raised + host_timing.interrupt_latency_cycles) {
+		next_event = earliest(next_event, irq_raised + host_timing.interrupt_latency_cycles);
+		return;
+	}
+	irq_pending = false;
+	irq_waiting = false;
+	host_counters.interrupts++;
+	in_interrupt = true;
+	SPI_Handler();
+	latched_status &= ~(SPI_SR_NSSR | SPI_SR_OVRES); // SPI_Handler reads SPI_SR, which clears them
+	end_rx = false;
+	end_tx = false;
+	in_interrupt = false;
+	thaw(host_timing.interrupt_cycles);
+}
+
+// Everything that is due at now
+static void step(void) {
+	sync();
+	while (shifting && (shift_end <= now)) {
+		uint64_t end = shift_end;
+		completeWord();
+		if (!loadWord(end)) {
+			deselect();
+		}
+	}
+	if (!shifting) {
+		loadWord(now);
+	}
+	while ((master_count > 0) && (master_next <= now)) {
+		receiveFromMaster();
+		master_next += host_timing.master_word_cycles;
+	}
+	takeInterrupts();
+
+	uint64_t next = now + IDLE_CYCLES;
+	if (shifting) {
+		next = earliest(next, shift_end);
+	}
+	if (master_count > 0) {
+		next = earliest(next, master_next);
+	}
+	if (periodic_cycles != 0) {
+		next = earliest(next, periodic_next);
+	}
+	if (irq_waiting) {
+		next = earliest(next, irq_raised + host_timing.interrupt_latency_cycles);
+	}
+	next_event = (next > now) ? next : (now + 1);
+}
+
+static void advance(uint64_t cycles) {
+	uint64_t target = now + cycles;
+	while (next_event <= target) {
+		if (next_event > now) {
+			now = next_event;
+		}
+		setClock();
+		step();
+		if (now > target) {
+			target = now; // An interrupt handler ran
+		}
+	}
+	now = target;
+	setClock();
+}
+
+Spi *host_spi(void) {
+	sync();
+	if ((critical_nesting > 0) || in_interrupt) {
+		frozen_cycles += host_timing.access_cycles;
+	}
+	else {
+		advance(host_timing.access_cycles);
+	}
+	sync();
+	return &registers;
+}
+
+void host_run(uint64_t cycles) {
+	advance(cycles);
+}
+
+static bool busIdle(void) {
+	sync();
+	return !shifting && (master_count == 0) && !irq_waiting &&
+		!(spi_enabled && isMaster() && ((registers.SPI_TDR != TDR_EMPTY) || transmitPending()));
+}
+
+void host_idle(void) {
+	uint64_t deadline = now + HANG_CYCLES;
+	uint8_t quiet = 0;
+	while (quiet < 4) {
+		advance(IDLE_CYCLES);
+		quiet = busIdle() ? (quiet + 1) : 0;
+		if (now > deadline) {
+			host_fail(__FILE__, __LINE__, "the bus never went idle");
+		}
+	}
+}
+
+uint64_t host_time(void) {
+	return now;
+}
+
+bool host_inInterrupt(void) {
+	return in_interrupt;
+}
+
+void host_clearWire(void) {
+	host_wireLength = 0;
+	host_wireOverflow = false;
+}
+
+void host_attachPanel(struct Ili9341Emulator *panel_to_attach, uint8_t chip_select) {
+	panel = panel_to_attach;
+	panel_chip_select = chip_select;
+}
+
+void host_initDisplay(struct Ili9341Emulator *panel_to_attach) {
+	spi_masterInit((struct SpiMaster){ .NVIC_spi_interrupt_priority = 10, .cs_1 = PA31 });
+	spi_chipSelectInit((struct SpiSlaveSettings){
+		.chip_select = NPCS1,
+		.peripheral_clock_hz = 100000000,
+		.spi_mode = MODE_0,
+		.spi_baudRate_hz = 25000000,
+#ifdef ILI9341_4WIRE
+		.bits_per_transfer = 8
+#else
+		.bits_per_transfer = 9
+#endif
+	});
+	ili9341_emulatorInit(panel_to_attach);
+	host_attachPanel(panel_to_attach, NPCS1);
+}
+
+void host_masterSend(const uint32_t *words, uint32_t count) {
+	master_words = words;
+	master_count = count;
+	master_next = now + host_timing.master_word_cycles;
+	next_event = earliest(next_event, master_next);
+}
+
+uint32_t host_masterPending(void) {
+	return master_count;
+}
+
+bool host_pinLevel(Pio *pio, uint8_t pin) {
+	return (pio->level >> pin) & 1;
+}
+
+void host_pinInterrupt(Pio *pio, uint8_t pin) {
+	if (pio->interrupt_handler[pin] == NULL) {
+		return;
+	}
+	host_counters.pin_interrupts++;
+	bool nested = in_interrupt;
+	in_interrupt = true;
+	pio->interrupt_handler[pin]();
+	in_interrupt = nested;
+	if (!nested && (critical_nesting == 0)) {
+		thaw(host_timing.interrupt_cycles);
+	}
+	else {
+		frozen_cycles += host_timing.interrupt_cycles;
+	}
+}
+
+void host_setPinInterruptPeriod(Pio *pio, uint8_t pin, uint32_t period_cycles) {
+	periodic_pio = pio;
+	periodic_pin = pin;
+	periodic_cycles = period_cycles;
+	periodic_next = now + period_cycles;
+	next_event = earliest(next_event, periodic_next);
+}
+
+// The test runs on its own stack, which has to lie below 4 GB like everything the PDC is given
+static void runTest(void (*test)(void)) {
+	void *stack = mmap(NULL, STACK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+	if (stack == MAP_FAILED) {
+		host_fail(__FILE__, __LINE__, "mmap of the test stack");
+	}
+	getcontext(&test_context);
+	test_context.uc_stack.ss_sp = stack;
+	test_context.uc_stack.ss_size = STACK_SIZE;
+	test_context.uc_link = &main_context;
+	makecontext(&test_context, test, 0);
+	swapcontext(&main_context, &test_context);
+	munmap(stack, STACK_SIZE);
+}
+
+int host_main(void (*test)(void)) {
+	setvbuf(stdout, NULL, _IONBF, 0);
+	registers.SPI_TDR = TDR_EMPTY;
+	runTest(test);
+	return 0;
+}
+
+// NVIC, only the SPI interrupt is modelled. Pin interrupts are run by host_pinInterrupt.
+void NVIC_EnableIRQ(IRQn_Type IRQn) {
+	if (IRQn == SPI_IRQn) {
+		irq_enabled = true;
+	}
+}
+
+void NVIC_DisableIRQ(IRQn_Type IRQn) {
+	if (IRQn == SPI_IRQn) {
+		irq_enabled = false;
+	}
+}
+
+void NVIC_SetPendingIRQ(IRQn_Type IRQn) {
+	if (IRQn == SPI_IRQn) {
+		irq_pending = true;
+	}
+}
+
+void NVIC_ClearPendingIRQ(IRQn_Type IRQn) {
+	if (IRQn == SPI_IRQn) {
+		irq_pending = false;
+	}
+}
+
+void NVIC_SetPriority(IRQn_Type IRQn, uint32_t priority) {
+}
+
+// pio.h
+void pio_enableOutput(Pio *pio, uint8_t pin) {
+}
+
+void pio_disableOutput(Pio *pio, uint8_t pin) {
+}
+
+void pio_setOutput(Pio *pio, uint8_t pin, enum PinLevel setState) {
+	bool level = (setState == PIN_HIGH);
+	if ((pio == PIOA) && (pin == DATA_COMMAND_PIN) && (host_pinLevel(pio, pin) != level) &&
+		(shifting || (registers.SPI_TDR != TDR_EMPTY) || transmitPending())) {
+		host_counters.data_command_violations++;
+	}
+	if (level) {
+		pio->level |= 1u << pin;
+	}
+	else {
+		pio->level &= ~(1u << pin);
+	}
+}
+
+void pio_setMux(Pio *pio, uint8_t pin, enum Peripheral mux) {
+}
+
+void pio_enableInterrupt(Pio *pio, uint8_t pin, enum InterruptType interruptType, void (*interruptFunction)(void)) {
+	pio->interrupt_handler[pin] = interruptFunction;
+}
+
+void pio_disableInterrupt(Pio *pio, uint8_t pin) {
+	pio->interrupt_handler[pin] = NULL;
+}
+
+// pmc.h and delay.h
+uint32_t pmc_enable_periph_clk(uint32_t irqnNumber) {
+	return 0;
+}
+
+void delay_ms(uint32_t ms) {
+	advance((uint64_t)ms * HOST_CYCLES_PER_TICK);
+}
+
+void delay_us(uint32_t us) {
+	advance((uint64_t)us * (HOST_CYCLES_PER_TICK / 1000));
+}
+
+// FreeRTOS, for the one task the test runs in
+void host_enterCritical(void) {
+	critical_nesting++;
+}
+
+void host_exitCritical(void) {
+	if (--critical_nesting == 0) {
+		thaw(0);
+	}
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+	return &main_context;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+	notifications++;
+	return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *higherPriorityTaskWoken) {
+	notifications++;
+	if (higherPriorityTaskWoken != NULL) {
+		*higherPriorityTaskWoken = pdTRUE;
+	}
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearCountOnExit, TickType_t ticksToWait) {
+	uint64_t deadline = (ticksToWait == portMAX_DELAY) ? (now + HANG_CYCLES) : (now + (uint64_t)ticksToWait * HOST_CYCLES_PER_TICK);
+	bool blocked = false;
+	while ((notifications == 0) && (now < deadline)) {
+		blocked = true;
+		advance((next_event > now) ? (next_event - now) : 1);
+	}
+	if (notifications == 0) {
+		if (ticksToWait == portMAX_DELAY) {
+			host_fail(__FILE__, __LINE__, "the task waits for a notification that never comes");
+		}
+		return 0;
+	}
+	if (blocked) {
+		advance(host_timing.switch_cycles);
+	}
+	uint32_t count = notifications;
+	notifications = clearCountOnExit ? 0 : (count - 1);
+	return count;
+}
+
+void vTaskDelay(TickType_t ticks) {
+	advance((uint64_t)ticks * HOST_CYCLES_PER_TICK);
+}
+
+TickType_t xTaskGetTickCount(void) {
+	return now / HOST_CYCLES_PER_TICK;
+}
+
+TickType_t xTaskGetTickCountFromISR(void) {
+	return now / HOST_CYCLES_PER_TICK;
+}
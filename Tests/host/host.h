@@ -0,0 +1,104 @@
+#ifndef HOST_H_
+#define HOST_H_
+
+// Runs the drivers on a PC. host.c models the SAM4N SPI with its PDC, the PIO pins and interrupts the
+// drivers use, and one FreeRTOS task. Time is counted in CPU cycles, and the SPI clock is taken from
+// SCBR and BITS of the chip select as on the chip, so DWT->CYCCNT can be used to compare code paths.
+// Every register access lets the model run for host_timing.access_cycles, which is when the PDC moves
+// words and status bits change. SPI_Handler is called when a status bit that is enabled in SPI_IMR is
+// set, outside of critical sections. Interrupt handlers and critical sections take no time while they run,
+// the cycles they cost are let pass when they end.
+//
+// A test is a function run by host_main, on a stack that lies below 4 GB since buffers are handed to the
+// 32-bit PDC registers. The tests are linked without PIE for the same reason.
+//
+//	static void test(void) {
+//		spi_masterInit((struct SpiMaster){ .NVIC_spi_interrupt_priority = 10 });
+//		spi_freeRTOSTranceive(words, 3, NULL, answer);
+//		HOST_CHECK(host_wireLength == 3);
+//	}
+//	int main(void) {
+//		return host_main(test);
+//	}
+
+#include "sam.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct Ili9341Emulator;
+
+// Cost of what the model can not see, in CPU cycles
+struct HostTiming {
+	/* One register access */
+	uint32_t access_cycles;
+	/* Entering and leaving an interrupt handler, on top of the accesses it makes */
+	uint32_t interrupt_cycles;
+	/* From a status bit being set until SPI_Handler is entered, as when a higher priority interrupt runs */
+	uint32_t interrupt_latency_cycles;
+	/* From a notification given in an interrupt until the waiting task runs again */
+	uint32_t switch_cycles;
+	/* Time between the words the master sends in slave mode */
+	uint32_t master_word_cycles;
+};
+
+// A word that went over the bus
+struct HostWord {
+	uint32_t data; /* As written to SPI_TDR, with PCS and LASTXFER in variable peripheral select */
+	uint8_t chip_select;
+	uint8_t bits;
+	uint8_t size; /* Bytes the PDC reads per word */
+	bool data_command; /* Level of the display D/C pin */
+	bool last; /* LASTXFER */
+};
+
+struct HostCounters {
+	uint64_t words;
+	uint32_t interrupts;
+	uint32_t pin_interrupts;
+	/* The display D/C pin changed while a word was on the bus or waiting for it */
+	uint32_t data_command_violations;
+};
+
+#define HOST_WIRE_LENGTH	(1u << 20)
+#define HOST_CYCLES_PER_TICK	100000u // 1 ms at 100 MHz
+
+#define HOST_CHECK(x)	do { if (!(x)) { host_fail(__FILE__, __LINE__, #x); } } while (0)
+
+extern struct HostTiming host_timing;
+extern struct HostCounters host_counters;
+// The first HOST_WIRE_LENGTH words since host_clearWire
+extern struct HostWord host_wire[HOST_WIRE_LENGTH];
+extern uint32_t host_wireLength;
+extern bool host_wireOverflow;
+// Answer of the devices on the bus other than an attached panel. NULL loops MOSI back to MISO.
+extern uint32_t (*host_miso)(uint32_t word);
+
+int host_main(void (*test)(void));
+void host_fail(const char *file, int line, const char *expression);
+
+// Lets the model run for a number of cycles, or until the bus and SPI_Handler have nothing left to do
+void host_run(uint64_t cycles);
+void host_idle(void);
+uint64_t host_time(void);
+// Whether SPI_Handler or a pin interrupt handler is running
+bool host_inInterrupt(void);
+void host_clearWire(void);
+
+// Feeds every word to chip_select to the panel, which also answers on MISO
+void host_attachPanel(struct Ili9341Emulator *panel, uint8_t chip_select);
+// Sets the SPI up for the display on NPCS1 the way an application would, with 9 bits per transfer for the
+// 3-wire interface or 8 for the 4-wire interface, and attaches the panel
+void host_initDisplay(struct Ili9341Emulator *panel);
+
+// Slave mode: the master sends the words, one every host_timing.master_word_cycles, then releases NSS
+void host_masterSend(const uint32_t *words, uint32_t count);
+uint32_t host_masterPending(void);
+
+bool host_pinLevel(Pio *pio, uint8_t pin);
+// Runs the interrupt handler registered with pio_enableInterrupt for the pin now, or every period
+// cycles (0 to stop)
+void host_pinInterrupt(Pio *pio, uint8_t pin);
+void host_setPinInterruptPeriod(Pio *pio, uint8_t pin, uint32_t period_cycles);
+
+#endif /* HOST_H_ */
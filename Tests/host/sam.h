@@ -0,0 +1,177 @@
+#ifndef SAM_H_
+#define SAM_H_
+
+// Host stand-in for the parts of the SAM4N device header the drivers use. The registers are plain 
+// structs that host.c models, see host.h.
+
+#include <stdint.h>
+
+#define __I	volatile const
+#define __O	volatile
+#define __IO	volatile
+
+typedef struct {
+	__O  uint32_t SPI_CR;
+	__IO uint32_t SPI_MR;
+	__I  uint32_t SPI_RDR;
+	__O  uint32_t SPI_TDR;
+	__I  uint32_t SPI_SR;
+	__O  uint32_t SPI_IER;
+	__O  uint32_t SPI_IDR;
+	__I  uint32_t SPI_IMR;
+	__I  uint32_t Reserved1[4];
+	__IO uint32_t SPI_CSR[4];
+	__I  uint32_t Reserved2[41];
+	__IO uint32_t SPI_WPMR;
+	__I  uint32_t SPI_WPSR;
+	__I  uint32_t Reserved3[5];
+	__IO uint32_t SPI_RPR;
+	__IO uint32_t SPI_RCR;
+	__IO uint32_t SPI_TPR;
+	__IO uint32_t SPI_TCR;
+	__IO uint32_t SPI_RNPR;
+	__IO uint32_t SPI_RNCR;
+	__IO uint32_t SPI_TNPR;
+	__IO uint32_t SPI_TNCR;
+	__O  uint32_t SPI_PTCR;
+	__I  uint32_t SPI_PTSR;
+} Spi;
+
+// The drivers only use the PIO through pio.h, which host.c implements
+typedef struct {
+	uint32_t level; // Output level of every pin
+	void (*interrupt_handler[32])(void);
+} Pio;
+
+typedef struct {
+	__IO uint32_t CTRL;
+	__IO uint32_t CYCCNT;
+} DWT_Type;
+
+typedef struct {
+	__IO uint32_t DEMCR;
+} CoreDebug_Type;
+
+// Every access to SPI goes through host_spi, which lets the model run for the time the access takes
+Spi *host_spi(void);
+extern Pio host_pio[3];
+extern DWT_Type host_dwt;
+extern CoreDebug_Type host_coreDebug;
+
+#define SPI	(host_spi())
+#define PIOA	(&host_pio[0])
+#define PIOB	(&host_pio[1])
+#define PIOC	(&host_pio[2])
+#define DWT	(&host_dwt)
+#define CoreDebug	(&host_coreDebug)
+
+typedef enum IRQn {
+	PIOA_IRQn = 11,
+	PIOB_IRQn = 12,
+	PIOC_IRQn = 13,
+	SPI_IRQn = 19
+} IRQn_Type;
+
+void NVIC_EnableIRQ(IRQn_Type IRQn);
+void NVIC_DisableIRQ(IRQn_Type IRQn);
+void NVIC_SetPendingIRQ(IRQn_Type IRQn);
+void NVIC_ClearPendingIRQ(IRQn_Type IRQn);
+void NVIC_SetPriority(IRQn_Type IRQn, uint32_t priority);
+
+#define CoreDebug_DEMCR_TRCENA_Msk	(1u << 24)
+#define DWT_CTRL_CYCCNTENA_Msk	(1u << 0)
+
+#define SPI_CR_SPIEN	(0x1u << 0)
+#define SPI_CR_SPIDIS	(0x1u << 1)
+#define SPI_CR_SWRST	(0x1u << 7)
+#define SPI_CR_LASTXFER	(0x1u << 24)
+#define SPI_MR_MSTR	(0x1u << 0)
+#define SPI_MR_PS	(0x1u << 1)
+#define SPI_MR_PCSDEC	(0x1u << 2)
+#define SPI_MR_MODFDIS	(0x1u << 4)
+#define SPI_MR_WDRBT	(0x1u << 5)
+#define SPI_MR_LLB	(0x1u << 7)
+#define SPI_MR_PCS_Pos	16
+#define SPI_MR_PCS_Msk	(0xfu << SPI_MR_PCS_Pos)
+#define SPI_MR_PCS(value)	((SPI_MR_PCS_Msk & ((value) << SPI_MR_PCS_Pos)))
+#define SPI_MR_DLYBCS_Pos	24
+#define SPI_MR_DLYBCS_Msk	(0xffu << SPI_MR_DLYBCS_Pos)
+#define SPI_MR_DLYBCS(value)	((SPI_MR_DLYBCS_Msk & ((value) << SPI_MR_DLYBCS_Pos)))
+#define SPI_RDR_RD_Msk	(0xffffu << 0)
+#define SPI_RDR_PCS_Msk	(0xfu << 16)
+#define SPI_TDR_TD_Msk	(0xffffu << 0)
+#define SPI_TDR_PCS_Pos	16
+#define SPI_TDR_PCS_Msk	(0xfu << SPI_TDR_PCS_Pos)
+#define SPI_TDR_PCS(value)	((SPI_TDR_PCS_Msk & ((value) << SPI_TDR_PCS_Pos)))
+#define SPI_TDR_LASTXFER	(0x1u << 24)
+#define SPI_SR_RDRF	(0x1u << 0)
+#define SPI_SR_TDRE	(0x1u << 1)
+#define SPI_SR_MODF	(0x1u << 2)
+#define SPI_SR_OVRES	(0x1u << 3)
+#define SPI_SR_ENDRX	(0x1u << 4)
+#define SPI_SR_ENDTX	(0x1u << 5)
+#define SPI_SR_RXBUFF	(0x1u << 6)
+#define SPI_SR_TXBUFE	(0x1u << 7)
+#define SPI_SR_NSSR	(0x1u << 8)
+#define SPI_SR_TXEMPTY	(0x1u << 9)
+#define SPI_SR_UNDES	(0x1u << 10)
+#define SPI_SR_SPIENS	(0x1u << 16)
+#define SPI_IER_RDRF	SPI_SR_RDRF
+#define SPI_IER_TDRE	SPI_SR_TDRE
+#define SPI_IER_MODF	SPI_SR_MODF
+#define SPI_IER_OVRES	SPI_SR_OVRES
+#define SPI_IER_ENDRX	SPI_SR_ENDRX
+#define SPI_IER_ENDTX	SPI_SR_ENDTX
+#define SPI_IER_RXBUFF	SPI_SR_RXBUFF
+#define SPI_IER_TXBUFE	SPI_SR_TXBUFE
+#define SPI_IER_NSSR	SPI_SR_NSSR
+#define SPI_IER_TXEMPTY	SPI_SR_TXEMPTY
+#define SPI_IDR_RDRF	SPI_SR_RDRF
+#define SPI_IDR_TDRE	SPI_SR_TDRE
+#define SPI_IDR_MODF	SPI_SR_MODF
+#define SPI_IDR_OVRES	SPI_SR_OVRES
+#define SPI_IDR_ENDRX	SPI_SR_ENDRX
+#define SPI_IDR_ENDTX	SPI_SR_ENDTX
+#define SPI_IDR_RXBUFF	SPI_SR_RXBUFF
+#define SPI_IDR_TXBUFE	SPI_SR_TXBUFE
+#define SPI_IDR_NSSR	SPI_SR_NSSR
+#define SPI_IDR_TXEMPTY	SPI_SR_TXEMPTY
+#define SPI_CSR_CPOL	(0x1u << 0)
+#define SPI_CSR_NCPHA	(0x1u << 1)
+#define SPI_CSR_CSNAAT	(0x1u << 2)
+#define SPI_CSR_CSAAT	(0x1u << 3)
+#define SPI_CSR_BITS_Pos	4
+#define SPI_CSR_BITS_Msk	(0xfu << SPI_CSR_BITS_Pos)
+#define SPI_CSR_BITS(value)	((SPI_CSR_BITS_Msk & ((value) << SPI_CSR_BITS_Pos)))
+#define SPI_CSR_SCBR_Pos	8
+#define SPI_CSR_SCBR_Msk	(0xffu << SPI_CSR_SCBR_Pos)
+#define SPI_CSR_SCBR(value)	((SPI_CSR_SCBR_Msk & ((value) << SPI_CSR_SCBR_Pos)))
+#define SPI_CSR_DLYBS_Pos	16
+#define SPI_CSR_DLYBS_Msk	(0xffu << SPI_CSR_DLYBS_Pos)
+#define SPI_CSR_DLYBS(value)	((SPI_CSR_DLYBS_Msk & ((value) << SPI_CSR_DLYBS_Pos)))
+#define SPI_CSR_DLYBCT_Pos	24
+#define SPI_CSR_DLYBCT_Msk	(0xffu << SPI_CSR_DLYBCT_Pos)
+#define SPI_CSR_DLYBCT(value)	((SPI_CSR_DLYBCT_Msk & ((value) << SPI_CSR_DLYBCT_Pos)))
+#define SPI_PTCR_RXTEN	(0x1u << 0)
+#define SPI_PTCR_RXTDIS	(0x1u << 1)
+#define SPI_PTCR_TXTEN	(0x1u << 8)
+#define SPI_PTCR_TXTDIS	(0x1u << 9)
+#define SPI_PTSR_RXTEN	(0x1u << 0)
+#define SPI_PTSR_TXTEN	(0x1u << 8)
+
+#define CKGR_MOR_MOSCRCF_4_MHz	(0x0u << 4)
+#define CKGR_MOR_MOSCRCF_8_MHz	(0x1u << 4)
+#define CKGR_MOR_MOSCRCF_12_MHz	(0x2u << 4)
+#define PMC_MCKR_PRES_CLK_1	(0x0u << 4)
+#define PMC_MCKR_PRES_CLK_2	(0x1u << 4)
+#define PMC_MCKR_PRES_CLK_4	(0x2u << 4)
+#define PMC_MCKR_PRES_CLK_8	(0x3u << 4)
+#define PMC_MCKR_PRES_CLK_16	(0x4u << 4)
+#define PMC_MCKR_PRES_CLK_32	(0x5u << 4)
+#define PMC_MCKR_PRES_CLK_64	(0x6u << 4)
+#define PMC_MCKR_PRES_CLK_3	(0x7u << 4)
+#define PMC_MCKR_CSS_SLOW_CLK	(0x0u << 0)
+#define PMC_MCKR_CSS_MAIN_CLK	(0x1u << 0)
+#define PMC_MCKR_CSS_PLLA_CLK	(0x2u << 0)
+
+#endif /* SAM_H_ */
@@ -0,0 +1,106 @@
+#include "host.h"
+#include "scenes.h"
+#include "ili9341.h"
+#include "ili9341_text.h"
+#include "ili9341_console.h"
+#include "ili9341_image.h"
+
+#include <stdio.h>
+
+// Converted from images/splash.ppm by the Makefile
+extern const struct Ili9341Image splash;
+
+static void drawFills(void) {
+	ili9341_fillScreen(0x0841);
+	ili9341_fillRect(10, 10, 100, 60, 0xF800);
+	ili9341_fillRect(60, 40, 100, 60, 0x07E0);
+	ili9341_fillRect(200, 280, 100, 100, 0x001F); // Clipped right and bottom
+	ili9341_fillRect(-20, 150, 50, 30, 0xFFE0); // Clipped left
+	ili9341_fillRectAlpha(40, 20, 160, 120, 0xFFFF, 96);
+	static uint16_t gradient[64 * 32];
+	for (uint16_t y = 0; y < 32; y++) {
+		for (uint16_t x = 0; x < 64; x++) {
+			gradient[y * 64 + x] = ((x / 2) << 11) | ((y * 2) << 5) | (31 - x / 2);
+		}
+	}
+	ili9341_writeRect(150, 200, 64, 32, gradient);
+}
+
+static void drawText(void) {
+	const struct Ili9341Font *font = &ili9341_font6x8;
+	ili9341_drawText(0, 0, "ILI9341 golden image test", font, 0xFFFF, 0x0000);
+	ili9341_drawText(12, 20, "0123456789 +-*/=<>()", font, 0xFFE0, 0x001F);
+	ili9341_drawText(12, 30, "The quick brown fox jumps over the lazy dog", font, 0x07E0, 0x0000);
+	ili9341_drawText(-9, 40, "clipped on the left", font, 0xF800, 0x0000);
+	ili9341_drawText(200, 50, "and on the right", font, 0xF81F, 0x0000);
+	ili9341_drawText(20, 316, "and at the bottom", font, 0x07FF, 0x0000);
+	char line[32];
+	for (uint8_t i = 0; i < 20; i++) {
+		snprintf(line, sizeof(line), "T%02u %5d.%u C", i, i * 37 - 100, i % 10);
+		ili9341_drawText((i % 2) * 120, 70 + (i / 2) * 10, line, font, (i % 3) ? 0xFFFF : 0xFD20, 0x2104);
+	}
+}
+
+static void drawLines(void) {
+	for (int16_t i = 0; i <= 16; i++) {
+		uint16_t color = (i * 2) << 11 | (63 - i * 4) << 5 | 16;
+		ili9341_drawLine(120, 160, i * 15, 0, color);
+		ili9341_drawLine(120, 160, i * 15, 319, color);
+		ili9341_drawLine(120, 160, 0, i * 20, color ^ 0xFFFF);
+		ili9341_drawLine(120, 160, 239, i * 20, color ^ 0xFFFF);
+	}
+	ili9341_drawLine(-50, 10, 300, 30, 0xFFFF); // Clipped at both ends
+	ili9341_drawRect(20, 20, 200, 280, 0xFFE0);
+	ili9341_drawHLine(0, 300, 240, 0xF800);
+	ili9341_drawVLine(5, 0, 320, 0x07E0);
+	for (int16_t i = 0; i < 40; i++) {
+		ili9341_drawPixel(100 + i, 250 + (i * i) % 17, 0xFFFF);
+	}
+}
+
+static void drawImages(void) {
+	ili9341_fillScreen(0x18E3);
+	ili9341_drawImage(10, 10, &splash);
+	ili9341_drawImage(180, 250, &splash); // Clipped right and bottom
+	ili9341_drawImage(-30, 120, &splash); // Clipped left
+	ili9341_drawImage(60, -40, &splash); // Clipped top
+}
+
+// Stripes in memory, then the middle of the screen scrolled so that they wrap around
+static void drawScrolled(void) {
+	for (uint16_t row = 0; row < ILI9341_TFTHEIGHT; row += 8) {
+		ili9341_fillRect(0, row, ILI9341_TFTWIDTH, 8, ((row / 8) & 1) ? 0xFFFF : (row << 5));
+	}
+	ili9341_drawText(4, 4, "fixed top", &ili9341_font6x8, 0x0000, 0xFFFF);
+	ili9341_setScrollArea(20, 280, 20);
+	ili9341_setScrollStart(100);
+}
+
+static void drawConsole(void) {
+	ili9341_fillRect(0, 0, ILI9341_TFTWIDTH, 16, 0x001F);
+	ili9341_drawText(4, 4, "event log", &ili9341_font6x8, 0xFFFF, 0x001F);
+	ili9341_consoleInit(16, 16, &ili9341_font6x8, 0x07E0, 0x0000);
+	char line[48];
+	for (uint8_t i = 0; i < 50; i++) {
+		snprintf(line, sizeof(line), "%04u event %u, the console scrolls\n", i * 13, i);
+		ili9341_consolePrint(line);
+	}
+	ili9341_consolePrint("a line that is too long for the console is wrapped onto the next one\n");
+}
+
+const struct HostScene host_scenes[] = {
+	{ "fills", drawFills },
+	{ "text", drawText },
+	{ "lines", drawLines },
+	{ "images", drawImages },
+	{ "scrolled", drawScrolled },
+	{ "console", drawConsole }
+};
+const uint32_t host_sceneCount = sizeof(host_scenes) / sizeof(host_scenes[0]);
+
+void host_resetScene(void) {
+	ili9341_setScrollArea(0, ILI9341_TFTHEIGHT, 0);
+	ili9341_setScrollStart(0);
+	ili9341_fillScreen(0x0000);
+	host_idle();
+}
@@ -0,0 +1,18 @@
+#ifndef SCENES_H_
+#define SCENES_H_
+
+// Drawings that use every primitive of Drivers/ili9341, for the golden image test and the words per
+// frame benchmark. Each starts from a black screen without scrolling, so they can run in any order.
+
+struct HostScene {
+	const char *name;
+	void (*draw)(void);
+};
+
+extern const struct HostScene host_scenes[];
+extern const uint32_t host_sceneCount;
+
+// Clears the screen and the scroll area that the scenes leave behind
+void host_resetScene(void);
+
+#endif /* SCENES_H_ */
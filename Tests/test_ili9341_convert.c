@@ -0,0 +1,211 @@
+#include "host.h"
+#include "ili9341.h"
+#include "ili9341_convert.h"
+#include "ili9341_emulator.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// The pixel format converters and blending against plain per channel references, for every value a
+// channel can take, and ili9341_writeRectFormat against the same references on the panel. The rounding
+// runs on four bytes at once, so the values next to 255 are where a carry could reach the next channel.
+
+#define MAX_PIXELS	(131 * 7)
+
+struct RectCase {
+	int16_t x;
+	int16_t y;
+	int16_t w;
+	int16_t h;
+};
+
+// Odd widths, a row longer than ILI9341_PIECE_PIXELS, and rectangles cut off at each edge
+static const struct RectCase rect_cases[] = {
+	{10, 10, 1, 1},
+	{20, 30, 7, 5},
+	{0, 100, 131, 7},
+	{-3, 200, 9, 4},
+	{235, 250, 11, 3},
+	{50, -2, 5, 5},
+	{100, 317, 13, 6},
+	{-5, -5, 131, 7}
+};
+
+static const enum Ili9341PixelFormat formats[] = {
+	ILI9341_FORMAT_RGB565, ILI9341_FORMAT_RGB888, ILI9341_FORMAT_ARGB8888, ILI9341_FORMAT_GRAY8
+};
+
+static struct Ili9341Emulator panel;
+// Words, so ARGB8888 pixels are aligned
+static uint32_t source_words[MAX_PIXELS];
+static uint8_t *const source = (uint8_t *)source_words;
+static uint16_t converted[MAX_PIXELS];
+static uint32_t random_state = 1;
+
+static uint8_t randomByte(void) {
+	random_state = random_state * 1103515245u + 12345u;
+	// Half of the bytes near the top, where the rounding saturates
+	uint8_t byte = random_state >> 16;
+	return (random_state & 0x80000000u) ? (0xF8 | byte) : byte;
+}
+
+// Nearest value in bits, and the top value for everything that rounds past it
+static uint16_t referenceChannel(uint8_t value, uint8_t bits) {
+	uint32_t rounded = value + (1u << (7 - bits));
+	return ((rounded > 255) ? 255 : rounded) >> (8 - bits);
+}
+
+static uint16_t referenceRGB(uint8_t red, uint8_t green, uint8_t blue) {
+	return (referenceChannel(red, 5) << 11) | (referenceChannel(green, 6) << 5) | referenceChannel(blue, 5);
+}
+
+static uint16_t referencePixel(const uint8_t *pixel, enum Ili9341PixelFormat format) {
+	switch (format) {
+		case ILI9341_FORMAT_RGB888:
+		return referenceRGB(pixel[0], pixel[1], pixel[2]);
+		case ILI9341_FORMAT_ARGB8888: {
+			uint32_t argb;
+			memcpy(&argb, pixel, sizeof(argb));
+			return referenceRGB(argb >> 16, argb >> 8, argb);
+		}
+		case ILI9341_FORMAT_GRAY8:
+		return referenceRGB(pixel[0], pixel[0], pixel[0]);
+		default: {
+			uint16_t color;
+			memcpy(&color, pixel, sizeof(color));
+			return color;
+		}
+	}
+}
+
+// Every value of one channel with the others at values whose rounding carries, and the grey levels
+// at every position in a group of four
+static void testChannels(void) {
+	static const uint8_t others[] = {0x00, 0x7F, 0x80, 0xFB, 0xFC, 0xFD, 0xFE, 0xFF};
+	for (uint32_t channel = 0; channel < 3; channel++) {
+		for (uint32_t other = 0; other < sizeof(others); other++) {
+			for (uint32_t value = 0; value < 256; value++) {
+				uint8_t rgb[3] = {others[other], others[other], others[other]};
+				rgb[channel] = value;
+				uint32_t argb = 0xFF000000u | (rgb[0] << 16) | (rgb[1] << 8) | rgb[2];
+				uint16_t expected = referenceRGB(rgb[0], rgb[1], rgb[2]);
+				uint16_t out;
+				ili9341_convertRGB888(&out, rgb, 1);
+				HOST_CHECK(out == expected);
+				ili9341_convertARGB8888(&out, &argb, 1);
+				HOST_CHECK(out == expected);
+			}
+		}
+	}
+	uint8_t greys[256 + 3];
+	uint16_t out[256 + 3];
+	for (uint32_t shift = 0; shift < 4; shift++) {
+		for (uint32_t i = 0; i < 256 + shift; i++) {
+			greys[i] = (i < shift) ? 0xFF : (i - shift);
+		}
+		ili9341_convertGray8(out, greys, 256 + shift);
+		for (uint32_t i = 0; i < 256 + shift; i++) {
+			HOST_CHECK(out[i] == referenceRGB(greys[i], greys[i], greys[i]));
+		}
+	}
+}
+
+// Every count up to 9 pixels, so each converter runs its groups of four and what is left over
+static void testCounts(void) {
+	for (uint32_t format = 0; format < sizeof(formats) / sizeof(formats[0]); format++) {
+		uint8_t bytes = ili9341_bytesPerPixel(formats[format]);
+		for (uint32_t count = 0; count <= 9; count++) {
+			for (uint32_t i = 0; i < count * bytes; i++) {
+				source[i] = randomByte();
+			}
+			converted[count] = 0xDEAD;
+			ili9341_convert(converted, source, count, formats[format]);
+			for (uint32_t i = 0; i < count; i++) {
+				HOST_CHECK(converted[i] == referencePixel(&source[i * bytes], formats[format]));
+			}
+			HOST_CHECK(converted[count] == 0xDEAD);
+		}
+	}
+}
+
+// Each channel of fg and bg weighted by alpha cut down to 0..32
+static uint16_t referenceBlend(uint16_t fg, uint16_t bg, uint8_t alpha) {
+	static const uint16_t masks[3] = {0xF800, 0x07E0, 0x001F};
+	uint32_t weight = (alpha + 4) >> 3;
+	uint16_t result = 0;
+	for (uint32_t i = 0; i < 3; i++) {
+		uint32_t mix = (fg & masks[i]) * weight + (bg & masks[i]) * (32 - weight);
+		result |= (mix >> 5) & masks[i];
+	}
+	return result;
+}
+
+static void testBlend(void) {
+	static const uint16_t colors[] = {0x0000, 0xFFFF, 0xF800, 0x07E0, 0x001F, 0x8410, 0x7BEF, 0x1234, 0xEDCB};
+	uint32_t color_count = sizeof(colors) / sizeof(colors[0]);
+	for (uint32_t f = 0; f < color_count; f++) {
+		for (uint32_t b = 0; b < color_count; b++) {
+			HOST_CHECK(ili9341_blend565(colors[f], colors[b], 255) == colors[f]);
+			HOST_CHECK(ili9341_blend565(colors[f], colors[b], 0) == colors[b]);
+			for (uint32_t alpha = 0; alpha < 256; alpha++) {
+				HOST_CHECK(ili9341_blend565(colors[f], colors[b], alpha) == referenceBlend(colors[f], colors[b], alpha));
+			}
+		}
+	}
+	// An odd count, every pixel on its own
+	uint16_t pixels[7];
+	for (uint32_t alpha = 0; alpha < 256; alpha += 17) {
+		for (uint32_t i = 0; i < 7; i++) {
+			pixels[i] = colors[i];
+		}
+		ili9341_blendColor(pixels, 7, 0x5AA5, alpha);
+		for (uint32_t i = 0; i < 7; i++) {
+			HOST_CHECK(pixels[i] == referenceBlend(0x5AA5, colors[i], alpha));
+		}
+	}
+}
+
+static void testWriteRectFormat(void) {
+	for (uint32_t format = 0; format < sizeof(formats) / sizeof(formats[0]); format++) {
+		uint8_t bytes = ili9341_bytesPerPixel(formats[format]);
+		for (uint32_t c = 0; c < sizeof(rect_cases) / sizeof(rect_cases[0]); c++) {
+			const struct RectCase *rect = &rect_cases[c];
+			for (uint32_t i = 0; i < (uint32_t)rect->w * rect->h * bytes; i++) {
+				source[i] = randomByte();
+			}
+			ili9341_fillScreen(0x0821);
+			ili9341_writeRectFormat(rect->x, rect->y, rect->w, rect->h, source, formats[format]);
+			host_idle();
+			for (int16_t row = -1; row <= rect->h; row++) {
+				for (int16_t column = -1; column <= rect->w; column++) {
+					int16_t x = rect->x + column;
+					int16_t y = rect->y + row;
+					if ((x < 0) || (x >= ILI9341_TFTWIDTH) || (y < 0) || (y >= ILI9341_TFTHEIGHT)) {
+						continue;
+					}
+					bool inside = (row >= 0) && (row < rect->h) && (column >= 0) && (column < rect->w);
+					uint16_t expected = inside ? referencePixel(&source[(row * rect->w + column) * bytes], formats[format]) : 0x0821;
+					if (ili9341_emulatorShownPixel(&panel, x, y) != expected) {
+						printf("format %u, rectangle %u: pixel %d,%d is %04x, not %04x\n", formats[format], c, x, y,
+							ili9341_emulatorShownPixel(&panel, x, y), expected);
+						HOST_CHECK(false);
+					}
+				}
+			}
+		}
+	}
+}
+
+static void test(void) {
+	host_initDisplay(&panel);
+	ili9341_init();
+	testChannels();
+	testCounts();
+	testBlend();
+	testWriteRectFormat();
+	printf("ok\n");
+}
+
+int main(void) {
+	return host_main(test);
+}
@@ -0,0 +1,90 @@
+#include "host.h"
+#include "ili9341.h"
+#include "ili9341_emulator.h"
+
+#include <stdio.h>
+
+// Fills and lines against a model of the screen: after every call each pixel of the panel has to match.
+
+static struct Ili9341Emulator panel;
+static uint16_t expected[ILI9341_TFTHEIGHT][ILI9341_TFTWIDTH];
+
+static void paint(int32_t x, int32_t y, int32_t w, int32_t h, uint16_t color) {
+	for (int32_t row = y; row < y + h; row++) {
+		for (int32_t column = x; column < x + w; column++) {
+			if ((row >= 0) && (row < ILI9341_TFTHEIGHT) && (column >= 0) && (column < ILI9341_TFTWIDTH)) {
+				expected[row][column] = color;
+			}
+		}
+	}
+}
+
+static void checkScreen(void) {
+	host_idle();
+	for (uint16_t y = 0; y < ILI9341_TFTHEIGHT; y++) {
+		for (uint16_t x = 0; x < ILI9341_TFTWIDTH; x++) {
+			if (ili9341_emulatorShownPixel(&panel, x, y) != expected[y][x]) {
+				printf("pixel %u,%u is %04x, not %04x\n", x, y, ili9341_emulatorShownPixel(&panel, x, y), expected[y][x]);
+				HOST_CHECK(false);
+			}
+		}
+	}
+}
+
+// A full screen clear is one window and one memory write
+static void testFillScreen(void) {
+	struct Ili9341EmulatorFrame frame;
+	ili9341_emulatorEndFrame(&panel, &frame);
+	ili9341_fillScreen(0x1234);
+	paint(0, 0, ILI9341_TFTWIDTH, ILI9341_TFTHEIGHT, 0x1234);
+	checkScreen();
+	ili9341_emulatorEndFrame(&panel, &frame);
+	HOST_CHECK(frame.commands == 3);
+	HOST_CHECK(frame.pixels_written == ILI9341_TFTWIDTH * ILI9341_TFTHEIGHT);
+}
+
+static void testFillRect(void) {
+	ili9341_fillRect(10, 20, 30, 40, 0xF800);
+	paint(10, 20, 30, 40, 0xF800);
+	checkScreen();
+	// Clipped on every side
+	ili9341_fillRect(-5, -7, 20, 30, 0x07E0);
+	paint(-5, -7, 20, 30, 0x07E0);
+	ili9341_fillRect(230, 310, 100, 100, 0x001F);
+	paint(230, 310, 100, 100, 0x001F);
+	ili9341_fillRect(-100, 100, 32767, 1, 0xFFFF);
+	paint(-100, 100, 32767, 1, 0xFFFF);
+	checkScreen();
+	// Nothing on the screen
+	ili9341_fillRect(240, 0, 10, 10, 0);
+	ili9341_fillRect(0, -10, 10, 10, 0);
+	ili9341_fillRect(5, 5, 0, 10, 0);
+	checkScreen();
+}
+
+// Lines longer than the screen stop at its edge, also those too long for the int16_t of fillRect
+static void testLongLines(void) {
+	ili9341_drawVLine(10, 300, 40000, 0xABCD);
+	paint(10, 300, 1, 20, 0xABCD);
+	ili9341_drawVLine(11, 0, 0xFFFF, 0x5555);
+	paint(11, 0, 1, ILI9341_TFTHEIGHT, 0x5555);
+	ili9341_drawVLine(12, 319, 1, 0x00FF);
+	paint(12, 319, 1, 1, 0x00FF);
+	ili9341_drawHLine(200, 5, 32767, 0x7777);
+	paint(200, 5, 40, 1, 0x7777);
+	ili9341_drawHLine(-32768, 6, 32767, 0x8888);
+	checkScreen();
+}
+
+static void test(void) {
+	host_initDisplay(&panel);
+	ili9341_init();
+	testFillScreen();
+	testFillRect();
+	testLongLines();
+	printf("ok\n");
+}
+
+int main(void) {
+	return host_main(test);
+}
@@ -0,0 +1,88 @@
+#include "host.h"
+#include "scenes.h"
+#include "ili9341.h"
+#include "ili9341_emulator.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Every scene is drawn through the SPI driver into the panel emulator, and what the panel shows is
+// compared with golden/<scene>.hash. The 3-wire and the 4-wire interface have to draw the same pictures.
+// A scene that does not match is written to $HOST_OUTPUT/<scene>.ppm to look at. After a change to
+// the pictures that is meant, run the test with HOST_GOLDEN_UPDATE=1 (make golden) to write new hashes.
+
+static struct Ili9341Emulator panel;
+
+// FNV-1a over the shown pixels
+static uint64_t hashScreen(void) {
+	uint64_t hash = 14695981039346656037u;
+	for (uint16_t y = 0; y < ILI9341_EMULATOR_HEIGHT; y++) {
+		for (uint16_t x = 0; x < ILI9341_EMULATOR_WIDTH; x++) {
+			uint16_t color = ili9341_emulatorShownPixel(&panel, x, y);
+			hash = (hash ^ (color >> 8)) * 1099511628211u;
+			hash = (hash ^ (color & 0xFF)) * 1099511628211u;
+		}
+	}
+	return hash;
+}
+
+static bool readGolden(const char *name, uint64_t *hash) {
+	char path[128];
+	snprintf(path, sizeof(path), "golden/%s.hash", name);
+	FILE *file = fopen(path, "r");
+	if (file == NULL) {
+		return false;
+	}
+	bool read = fscanf(file, "%" SCNx64, hash) == 1;
+	fclose(file);
+	return read;
+}
+
+static void writeGolden(const char *name, uint64_t hash) {
+	char path[128];
+	snprintf(path, sizeof(path), "golden/%s.hash", name);
+	FILE *file = fopen(path, "w");
+	HOST_CHECK(file != NULL);
+	fprintf(file, "%016" PRIx64 "\n", hash);
+	HOST_CHECK(fclose(file) == 0);
+}
+
+static void test(void) {
+	const char *output = getenv("HOST_OUTPUT");
+	bool update = getenv("HOST_GOLDEN_UPDATE") != NULL;
+	host_initDisplay(&panel);
+	ili9341_init();
+	uint32_t failed = 0;
+	for (uint32_t i = 0; i < host_sceneCount; i++) {
+		const struct HostScene *scene = &host_scenes[i];
+		host_resetScene();
+		scene->draw();
+		host_idle();
+		uint64_t hash = hashScreen();
+		if (update) {
+			writeGolden(scene->name, hash);
+			continue;
+		}
+		uint64_t golden;
+		if (!readGolden(scene->name, &golden)) {
+			printf("%s: no golden/%s.hash, run from Tests/ or make golden\n", scene->name, scene->name);
+			failed++;
+		}
+		else if (hash != golden) {
+			char path[256];
+			snprintf(path, sizeof(path), "%s/%s.ppm", (output != NULL) ? output : ".", scene->name);
+			ili9341_emulatorWritePPM(&panel, path);
+			printf("%s: %016" PRIx64 " instead of %016" PRIx64 ", see %s\n", scene->name, hash, golden, path);
+			failed++;
+		}
+	}
+	HOST_CHECK(failed == 0);
+	// In 4-wire mode D/C may only change with the bus idle
+	HOST_CHECK(host_counters.data_command_violations == 0);
+	printf("ok, %u scenes\n", host_sceneCount);
+}
+
+int main(void) {
+	return host_main(test);
+}
@@ -0,0 +1,122 @@
+#include "host.h"
+#include "ili9341.h"
+#include "ili9341_emulator.h"
+#ifndef ILI9341_4WIRE
+#include "ili9341_list.h"
+#endif
+
+#include <stdio.h>
+
+// A display list against a model of the screen: what it draws has to match pixel for pixel, and the
+// whole list has to reach the display as one transfer. Lists only exist for the 3-wire interface.
+
+#ifndef ILI9341_4WIRE
+
+#define LIST_WORDS	4096
+#define LIST_SEGMENTS	64
+
+static struct Ili9341Emulator panel;
+static uint16_t expected[ILI9341_TFTHEIGHT][ILI9341_TFTWIDTH];
+static uint32_t words[LIST_WORDS];
+static struct SpiSegment segments[LIST_SEGMENTS];
+
+static const uint8_t glyph[8] = {0x18, 0x24, 0x42, 0x7E, 0x42, 0x42, 0x42, 0x00};
+
+static void paint(int32_t x, int32_t y, int32_t w, int32_t h, uint16_t color) {
+	for (int32_t row = y; row < y + h; row++) {
+		for (int32_t column = x; column < x + w; column++) {
+			if ((row >= 0) && (row < ILI9341_TFTHEIGHT) && (column >= 0) && (column < ILI9341_TFTWIDTH)) {
+				expected[row][column] = color;
+			}
+		}
+	}
+}
+
+static bool paintRun(void *user, int16_t x, int16_t y, int16_t w, int16_t h) {
+	paint(x, y, w, h, *(const uint16_t *)user);
+	return true;
+}
+
+static void paintGlyph(int16_t x, int16_t y, uint16_t fg, uint16_t bg) {
+	for (int16_t row = 0; row < 8; row++) {
+		for (int16_t column = 0; column < 8; column++) {
+			paint(x + column, y + row, 1, 1, ((glyph[row] << column) & 0x80) ? fg : bg);
+		}
+	}
+}
+
+static void checkScreen(void) {
+	for (uint16_t y = 0; y < ILI9341_TFTHEIGHT; y++) {
+		for (uint16_t x = 0; x < ILI9341_TFTWIDTH; x++) {
+			if (ili9341_emulatorShownPixel(&panel, x, y) != expected[y][x]) {
+				printf("pixel %u,%u is %04x, not %04x\n", x, y, ili9341_emulatorShownPixel(&panel, x, y), expected[y][x]);
+				HOST_CHECK(false);
+			}
+		}
+	}
+}
+
+static void test(void) {
+	host_initDisplay(&panel);
+	ili9341_init();
+	ili9341_fillScreen(0);
+	paint(0, 0, ILI9341_TFTWIDTH, ILI9341_TFTHEIGHT, 0);
+	host_idle();
+	host_clearWire();
+
+	struct Ili9341DisplayList list;
+	ili9341_listInit(&list, words, LIST_WORDS, segments, LIST_SEGMENTS);
+	ili9341_listClear(&list);
+	// A fill larger than ILI9341_LIST_FILL_PIXELS, so it is sent as a repeated block
+	HOST_CHECK(ili9341_listFillRect(&list, 20, 30, 100, 50, 0xF800));
+	paint(20, 30, 100, 50, 0xF800);
+	HOST_CHECK(ili9341_listFillRect(&list, -10, 300, 30, 40, 0x07E0));
+	paint(-10, 300, 30, 40, 0x07E0);
+	HOST_CHECK(ili9341_listRect(&list, 50, 50, 80, 60, 0x001F));
+	paint(50, 50, 80, 1, 0x001F);
+	paint(50, 109, 80, 1, 0x001F);
+	paint(50, 50, 1, 60, 0x001F);
+	paint(129, 50, 1, 60, 0x001F);
+	uint16_t line_color = 0xFFE0;
+	HOST_CHECK(ili9341_listLine(&list, 5, 200, 230, 150, line_color));
+	ili9341_lineRuns(5, 200, 230, 150, paintRun, &line_color);
+	HOST_CHECK(ili9341_listPixel(&list, 239, 319, 0xFFFF));
+	paint(239, 319, 1, 1, 0xFFFF);
+	HOST_CHECK(ili9341_listPixel(&list, 240, 0, 0xFFFF));
+	HOST_CHECK(ili9341_listGlyph(&list, 100, 250, glyph, 8, 8, 0x1234, 0x4321));
+	paintGlyph(100, 250, 0x1234, 0x4321);
+
+	// A primitive that does not fit leaves the list as it was
+	uint32_t word_count = list.word_count;
+	uint16_t segment_count = list.segment_count;
+	list.word_capacity = list.word_count + 1;
+	HOST_CHECK(!ili9341_listFillRect(&list, 0, 0, 10, 10, 0));
+	HOST_CHECK((list.word_count == word_count) && (list.segment_count == segment_count));
+	list.word_capacity = LIST_WORDS;
+
+	// Nothing is sent before the flush
+	host_idle();
+	HOST_CHECK(host_wireLength == 0);
+	struct SpiStatistics before;
+	struct SpiStatistics after;
+	spi_getStatistics(ILI9341_CHIP_SELECT, &before);
+	ili9341_listFlush(&list);
+	ili9341_listWait(&list);
+	host_idle();
+	spi_getStatistics(ILI9341_CHIP_SELECT, &after);
+	HOST_CHECK(after.transfers == before.transfers + 1);
+	checkScreen();
+	printf("ok, %u words in %u segments\n", list.word_count, list.segment_count);
+}
+
+#else
+
+static void test(void) {
+	printf("not built for the 4-wire interface\n");
+}
+
+#endif
+
+int main(void) {
+	return host_main(test);
+}
@@ -0,0 +1,130 @@
+#include "host.h"
+#include "ili9341.h"
+#include "ili9341_tear.h"
+#include "ili9341_emulator.h"
+
+#include <stdio.h>
+
+// Frame pacing on a TE pin that rises every PERIOD cycles. Transfers queued with ili9341_submitOnTear
+// must not start before the next edge, frames drawn by a task start behind an edge, and a frame that
+// is not done at the edge after it counts as late. The frames go to NPCS0 at 1 MHz, so a frame of
+// SHORT_WORDS fits in a refresh and one of LONG_WORDS does not.
+
+#define PERIOD	1400000 // 14 ms at 100 MHz
+#define WORD_CYCLES	800 // 8 bits at 1 MHz
+#define SHORT_WORDS	100
+#define LONG_WORDS	2000
+
+static struct Ili9341Emulator panel;
+static uint32_t words[LONG_WORDS];
+static uint64_t first_edge;
+
+static uint64_t edge(uint32_t n) {
+	return first_edge + (uint64_t)n * PERIOD;
+}
+
+static void runUntil(uint64_t time) {
+	HOST_CHECK(host_time() <= time);
+	host_run(time - host_time());
+}
+
+static void checkStatistics(uint32_t refreshes, uint32_t frames, uint32_t late_frames) {
+	struct Ili9341FrameStatistics statistics;
+	ili9341_getFrameStatistics(&statistics);
+	HOST_CHECK(statistics.refreshes == refreshes);
+	HOST_CHECK(statistics.frames == frames);
+	HOST_CHECK(statistics.late_frames == late_frames);
+	if (refreshes > 1) {
+		HOST_CHECK((statistics.refresh_cycles > PERIOD - 1000) && (statistics.refresh_cycles < PERIOD + 1000));
+	}
+}
+
+static void makeFrame(struct SpiTransfer *transfer, uint32_t length) {
+	for (uint32_t i = 0; i < length; i++) {
+		words[i] = spi_word(i == length - 1, NPCS0, i & 0xFF);
+	}
+	*transfer = (struct SpiTransfer){ .transmit_buffer = words, .buffer_length = length, .chip_select = NPCS0,
+		.notify_task = xTaskGetCurrentTaskHandle() };
+}
+
+// Queued half way through a refresh, sent from the next edge
+static void testSubmitOnTear(void) {
+	static struct SpiTransfer transfer;
+	makeFrame(&transfer, SHORT_WORDS);
+	runUntil(edge(0) + PERIOD / 2);
+	host_clearWire();
+	spi_resetStatistics();
+	HOST_CHECK(ili9341_submitOnTear(&transfer));
+	runUntil(edge(1) - 1000);
+	HOST_CHECK((host_wireLength == 0) && !spi_transferIsDone(&transfer));
+	checkStatistics(1, 0, 0);
+
+	runUntil(edge(1) + 10 * WORD_CYCLES);
+	HOST_CHECK(host_wireLength > 0);
+	HOST_CHECK(spi_waitForTransfer(&transfer) == SPI_TRANSFER_DONE);
+	HOST_CHECK(host_wireLength == SHORT_WORDS);
+	struct SpiStatistics statistics;
+	spi_getStatistics(NPCS0, &statistics);
+	HOST_CHECK((statistics.transfers == 1) && (statistics.max_wait_cycles < 1000));
+	checkStatistics(2, 1, 0);
+	// Done well before the next edge, so it is not late
+	runUntil(edge(2) + 1000);
+	checkStatistics(3, 1, 0);
+}
+
+// Still being sent at the next edge
+static void testLateTransfer(void) {
+	static struct SpiTransfer transfer;
+	makeFrame(&transfer, LONG_WORDS);
+	HOST_CHECK(LONG_WORDS * WORD_CYCLES > PERIOD);
+	HOST_CHECK(ili9341_submitOnTear(&transfer));
+	runUntil(edge(3) + 1000);
+	checkStatistics(4, 2, 0);
+	HOST_CHECK(spi_waitForTransfer(&transfer) == SPI_TRANSFER_DONE);
+	HOST_CHECK(host_time() > edge(4));
+	checkStatistics(5, 2, 1);
+}
+
+// A frame the task draws itself starts behind an edge, and is late if it has not ended at the next one
+static void testTaskFrames(void) {
+	static struct SpiTransfer transfer;
+	ili9341_beginFrame();
+	HOST_CHECK((host_time() >= edge(5)) && (host_time() < edge(5) + 1000));
+	checkStatistics(6, 3, 1);
+	makeFrame(&transfer, SHORT_WORDS);
+	spi_submitTransfer(&transfer);
+	HOST_CHECK(spi_waitForTransfer(&transfer) == SPI_TRANSFER_DONE);
+	ili9341_endFrame();
+	runUntil(edge(6) + 1000);
+	checkStatistics(7, 3, 1);
+
+	ili9341_beginFrame();
+	HOST_CHECK((host_time() >= edge(7)) && (host_time() < edge(7) + 1000));
+	runUntil(edge(8) + 1000);
+	ili9341_endFrame();
+	checkStatistics(9, 4, 2);
+}
+
+static void test(void) {
+	host_initDisplay(&panel);
+	ili9341_init();
+	spi_chipSelectInit((struct SpiSlaveSettings){ .chip_select = NPCS0, .peripheral_clock_hz = 100000000,
+		.spi_mode = MODE_0, .spi_baudRate_hz = 1000000, .bits_per_transfer = 8 });
+	ili9341_tearInit(10, 0);
+	host_idle();
+	host_setPinInterruptPeriod(ILI9341_TE_PIO, ILI9341_TE_PIN, PERIOD);
+	first_edge = host_time() + PERIOD;
+	runUntil(edge(0) + 1000);
+	checkStatistics(1, 0, 0);
+
+	testSubmitOnTear();
+	testLateTransfer();
+	testTaskFrames();
+	host_setPinInterruptPeriod(ILI9341_TE_PIO, ILI9341_TE_PIN, 0);
+	ili9341_tearDisable();
+	printf("ok\n");
+}
+
+int main(void) {
+	return host_main(test);
+}
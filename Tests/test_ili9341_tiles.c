@@ -0,0 +1,171 @@
+#include "host.h"
+#include "ili9341.h"
+#include "ili9341_tiles.h"
+#include "ili9341_emulator.h"
+
+#include <stdio.h>
+
+// Only the dirty tiles are sent, each of them once, and what they show is what the render function drew.
+// The test keeps its own model of the dirty tiles and of the scene generation every pixel shows, and
+// checks the whole panel against it after each flush, for overlapping changes and for changes that
+// reach past the edges of the screen. Prints the words a full screen and a small change cost.
+
+struct Change {
+	int16_t x;
+	int16_t y;
+	int16_t w;
+	int16_t h;
+};
+
+static struct Ili9341Emulator panel;
+static uint16_t generation;
+static uint32_t rendered_pixels;
+static bool expected_dirty[ILI9341_TILE_ROWS][ILI9341_TILE_COLUMNS];
+static uint16_t shown_generation[ILI9341_TFTHEIGHT][ILI9341_TFTWIDTH];
+
+static uint16_t scene(int16_t x, int16_t y, uint16_t scene_generation) {
+	return (x * 31 + y * 7) ^ scene_generation;
+}
+
+static void render(uint16_t *pixels, int16_t x, int16_t y, int16_t w, int16_t h, void *user) {
+	HOST_CHECK((x >= 0) && (y >= 0) && (w > 0) && (h > 0));
+	HOST_CHECK((x + w <= ILI9341_TFTWIDTH) && (y + h <= ILI9341_TFTHEIGHT));
+	HOST_CHECK((uint32_t)w * h <= ILI9341_STRIP_PIXELS);
+	rendered_pixels += (uint32_t)w * h;
+	for (int16_t row = 0; row < h; row++) {
+		for (int16_t column = 0; column < w; column++) {
+			*pixels++ = scene(x + column, y + row, generation);
+		}
+	}
+}
+
+// Every tile that shares a pixel with the rectangle becomes dirty
+static void markDirty(int16_t x, int16_t y, int16_t w, int16_t h) {
+	for (int16_t row = 0; row < ILI9341_TILE_ROWS; row++) {
+		for (int16_t column = 0; column < ILI9341_TILE_COLUMNS; column++) {
+			int16_t tile_x = column * ILI9341_TILE_SIZE;
+			int16_t tile_y = row * ILI9341_TILE_SIZE;
+			if ((w > 0) && (h > 0) && (x < tile_x + ILI9341_TILE_SIZE) && (x + w > tile_x) &&
+				(y < tile_y + ILI9341_TILE_SIZE) && (y + h > tile_y)) {
+				expected_dirty[row][column] = true;
+			}
+		}
+	}
+}
+
+static void invalidate(int16_t x, int16_t y, int16_t w, int16_t h) {
+	ili9341_invalidate(x, y, w, h);
+	markDirty(x, y, w, h);
+}
+
+static uint32_t flush(uint16_t flush_generation) {
+	uint32_t dirty_pixels = 0;
+	for (int16_t row = 0; row < ILI9341_TILE_ROWS; row++) {
+		for (int16_t column = 0; column < ILI9341_TILE_COLUMNS; column++) {
+			if (!expected_dirty[row][column]) {
+				continue;
+			}
+			expected_dirty[row][column] = false;
+			dirty_pixels += ILI9341_TILE_SIZE * ILI9341_TILE_SIZE;
+			for (int16_t y = row * ILI9341_TILE_SIZE; y < (row + 1) * ILI9341_TILE_SIZE; y++) {
+				for (int16_t x = column * ILI9341_TILE_SIZE; x < (column + 1) * ILI9341_TILE_SIZE; x++) {
+					shown_generation[y][x] = flush_generation;
+				}
+			}
+		}
+	}
+	HOST_CHECK(ili9341_isDirty() == (dirty_pixels > 0));
+
+	generation = flush_generation;
+	rendered_pixels = 0;
+	host_clearWire();
+	ili9341_flushDirty(render, NULL);
+	host_idle();
+	HOST_CHECK(!host_wireOverflow);
+	HOST_CHECK(!ili9341_isDirty());
+	HOST_CHECK(rendered_pixels == dirty_pixels);
+	for (int16_t y = 0; y < ILI9341_TFTHEIGHT; y++) {
+		for (int16_t x = 0; x < ILI9341_TFTWIDTH; x++) {
+			uint16_t expected = scene(x, y, shown_generation[y][x]);
+			if (ili9341_emulatorShownPixel(&panel, x, y) != expected) {
+				printf("generation %04x: pixel %d,%d is %04x, not %04x\n", flush_generation, x, y,
+					ili9341_emulatorShownPixel(&panel, x, y), expected);
+				HOST_CHECK(false);
+			}
+		}
+	}
+	return host_wireLength;
+}
+
+static void invalidateAll(const struct Change *changes, uint32_t count) {
+	for (uint32_t i = 0; i < count; i++) {
+		invalidate(changes[i].x, changes[i].y, changes[i].w, changes[i].h);
+	}
+}
+
+// Rectangles on top of each other, one inside another, the same one twice, and two that only touch
+// at a tile border
+static void testOverlapping(void) {
+	static const struct Change changes[] = {
+		{20, 40, 50, 30},
+		{50, 60, 40, 40},
+		{30, 50, 10, 10},
+		{50, 60, 40, 40},
+		{160, 16, 16, 16},
+		{176, 16, 16, 16},
+		{150, 200, 60, 5},
+		{170, 190, 5, 40}
+	};
+	invalidateAll(changes, sizeof(changes) / sizeof(changes[0]));
+	flush(0x1111);
+}
+
+// Rectangles cut off by each edge and corner, single pixels on the last column and row, and rectangles
+// that are wholly off the screen or empty, which leave nothing dirty
+static void testEdges(void) {
+	static const struct Change changes[] = {
+		{-10, -5, 30, 20},
+		{230, 300, 40, 40},
+		{-50, 150, 60, 1},
+		{239, 0, 1, 1},
+		{0, 319, 1, 1},
+		{100, 310, 20, 100},
+		{200, -100, 10, 101}
+	};
+	invalidateAll(changes, sizeof(changes) / sizeof(changes[0]));
+	flush(0x2222);
+
+	static const struct Change outside[] = {
+		{-20, 10, 20, 5},
+		{240, 0, 5, 5},
+		{10, 320, 5, 5},
+		{10, -5, 5, 5},
+		{50, 50, 0, 10},
+		{50, 50, 10, -3}
+	};
+	invalidateAll(outside, sizeof(outside) / sizeof(outside[0]));
+	HOST_CHECK(!ili9341_isDirty());
+	HOST_CHECK(flush(0x3333) == 0);
+}
+
+static void test(void) {
+	host_initDisplay(&panel);
+	ili9341_init();
+
+	ili9341_invalidateScreen();
+	markDirty(0, 0, ILI9341_TFTWIDTH, ILI9341_TFTHEIGHT);
+	uint32_t full_words = flush(0);
+
+	// 40x20 pixels at 100,100 touch the tiles from 96,96 to 144,128
+	invalidate(100, 100, 40, 20);
+	uint32_t change_words = flush(0x5A5A);
+	HOST_CHECK(change_words < full_words / 40);
+
+	testOverlapping();
+	testEdges();
+	printf("full screen %u words, 40x20 change %u words\n", full_words, change_words);
+}
+
+int main(void) {
+	return host_main(test);
+}
@@ -0,0 +1,73 @@
+#include "host.h"
+#include "spi.h"
+
+#include <stdio.h>
+
+// spi_calibrateClock against a flash whose JEDEC ID reads back wrong when the clock divider is below
+// the slowest it works at
+
+static const uint8_t flash_id[3] = {0xEF, 0x40, 0x18};
+static uint8_t working_divider;
+static uint8_t divider_in_use;
+static uint8_t answer_index;
+static uint32_t readbacks;
+
+// The device answers the ID after the command byte, with bits flipped when it is clocked too fast
+static uint32_t flash(uint32_t word) {
+	if ((word & 0xFF) == 0x9F) {
+		answer_index = 0;
+		return 0xFF;
+	}
+	uint8_t answer = (answer_index < 3) ? flash_id[answer_index] : 0xFF;
+	answer_index++;
+	return (divider_in_use < working_divider) ? (answer ^ 0x24) : answer;
+}
+
+static bool checkId(void *user) {
+	uint8_t command[4] = {0x9F, 0, 0, 0};
+	uint8_t answer[4];
+	divider_in_use = spi_getClockDivider(NPCS2);
+	readbacks++;
+	spi_freeRTOSTranceivePacked(NPCS2, SPI_FORMAT_PACKED_8, command, 4, answer);
+	return (answer[1] == flash_id[0]) && (answer[2] == flash_id[1]) && (answer[3] == flash_id[2]);
+}
+
+static void calibrate(uint8_t works_from, uint8_t slowest, uint8_t margin, uint8_t expected) {
+	working_divider = works_from;
+	readbacks = 0;
+	spi_setClockDivider(NPCS2, 100);
+	uint8_t divider = spi_calibrateClock(NPCS2, slowest, margin, checkId, NULL);
+	HOST_CHECK(divider == expected);
+	HOST_CHECK(spi_getClockDivider(NPCS2) == ((expected != 0) ? expected : 100));
+	// The divider still works for a transfer
+	if (expected != 0) {
+		HOST_CHECK(checkId(NULL));
+	}
+}
+
+static void test(void) {
+	spi_masterInit((struct SpiMaster){ .NVIC_spi_interrupt_priority = 10, .cs_2 = PA30 });
+	spi_chipSelectInit((struct SpiSlaveSettings){ .chip_select = NPCS2, .peripheral_clock_hz = 100000000, 
+		.spi_mode = MODE_0, .spi_baudRate_hz = 1000000, .bits_per_transfer = 8 });
+	host_miso = flash;
+	
+	// The smallest divider that works, and that plus the margin
+	calibrate(7, 60, 0, 7);
+	// Every pass at 60 down to 7, the failing read at 6, and the check after the calibration
+	HOST_CHECK(readbacks == (60 - 7 + 1) * SPI_CALIBRATION_PASSES + 1 + 1);
+	calibrate(7, 60, 2, 9);
+	// The margin does not go past the slowest divider
+	calibrate(58, 60, 5, 60);
+	// Works down to SCBR 1
+	calibrate(1, 20, 0, 1);
+	// Does not work at all: the divider from before is put back
+	calibrate(70, 60, 2, 0);
+	HOST_CHECK(readbacks == 1);
+	
+	host_miso = NULL;
+	printf("ok\n");
+}
+
+int main(void) {
+	return host_main(test);
+}
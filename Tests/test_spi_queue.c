@@ -0,0 +1,253 @@
+#include "host.h"
+#include "spi.h"
+
+#include <stdio.h>
+
+// Queued transfers go out back to back and in order, with their callbacks and notifications, 
+// and the blocking wrapper keeps the timing of its old callback.
+
+static uint32_t first[5] = {1, 2, 3, 4, 5};
+static uint32_t second[3] = {6, 7, 8};
+static uint32_t first_answer[5];
+static uint32_t second_answer[3];
+static int callback_sum;
+
+static void countCallback(void *user, enum SpiTransferStatus status) {
+	HOST_CHECK(host_inInterrupt());
+	HOST_CHECK(status == SPI_TRANSFER_DONE);
+	callback_sum += (int)(intptr_t)user;
+}
+
+static void testTwoTransfers(void) {
+	static struct SpiTransfer a;
+	static struct SpiTransfer b;
+	a = (struct SpiTransfer){ .transmit_buffer = first, .receive_buffer = first_answer, .buffer_length = 5, 
+		.callBackFunc = countCallback, .user = (void *)1, .notify_task = xTaskGetCurrentTaskHandle() };
+	b = (struct SpiTransfer){ .transmit_buffer = second, .receive_buffer = second_answer, .buffer_length = 3, 
+		.callBackFunc = countCallback, .user = (void *)10 };
+	host_clearWire();
+	spi_submitTransfer(&a);
+	spi_submitTransfer(&b);
+	HOST_CHECK(spi_waitForTransfer(&a) == SPI_TRANSFER_DONE);
+	host_idle();
+	HOST_CHECK(spi_transferIsDone(&b));
+	HOST_CHECK(callback_sum == 11);
+	HOST_CHECK(host_wireLength == 8);
+	for (uint32_t i = 0; i < 8; i++) {
+		HOST_CHECK(host_wire[i].data == i + 1);
+	}
+	HOST_CHECK((first_answer[4] == 5) && (second_answer[2] == 8));
+}
+
+// Twenty transfers of different lengths, at several interrupt latencies. The PDC has to roll from 
+// one transfer to the next without losing or repeating a word.
+static void testManyTransfers(void) {
+	static uint32_t buffers[20][10];
+	static uint32_t answers[20][10];
+	static struct SpiTransfer transfers[20];
+	for (uint32_t latency = 0; latency < 1000; latency += 150) {
+		host_timing.interrupt_latency_cycles = latency;
+		host_clearWire();
+		for (uint32_t i = 0; i < 20; i++) {
+			uint32_t length = 1 + (i * 7) % 10;
+			for (uint32_t j = 0; j < length; j++) {
+				buffers[i][j] = i * 100 + j;
+				answers[i][j] = 0;
+			}
+			transfers[i] = (struct SpiTransfer){ .transmit_buffer = buffers[i], .receive_buffer = answers[i], 
+				.buffer_length = length, .notify_task = (i == 19) ? xTaskGetCurrentTaskHandle() : NULL };
+			spi_submitTransfer(&transfers[i]);
+		}
+		spi_waitForTransfer(&transfers[19]);
+		host_idle();
+		uint32_t k = 0;
+		for (uint32_t i = 0; i < 20; i++) {
+			HOST_CHECK(spi_transferIsDone(&transfers[i]));
+			for (uint32_t j = 0; j < 1 + (i * 7) % 10; j++) {
+				HOST_CHECK(host_wire[k++].data == i * 100 + j);
+				HOST_CHECK(answers[i][j] == i * 100 + j);
+			}
+		}
+		HOST_CHECK(k == host_wireLength);
+	}
+	host_timing.interrupt_latency_cycles = 0;
+}
+
+static bool legacy_called_in_interrupt;
+static int legacy_calls;
+
+static void legacyCallback(void) {
+	legacy_called_in_interrupt = host_inInterrupt();
+	legacy_calls++;
+}
+
+// The callback of spi_freeRTOSTranceive runs in SPI_Handler when the transfer is done, as it always has, 
+// also for transfers short enough to be polled
+static void testLegacyCallback(void) {
+	static uint32_t words[40];
+	static uint32_t answer[40];
+	for (uint32_t i = 0; i < 40; i++) {
+		words[i] = spi_word(i == 39, NPCS0, i);
+	}
+	uint32_t lengths[2] = {1, 40};
+	for (uint8_t i = 0; i < 2; i++) {
+		legacy_calls = 0;
+		legacy_called_in_interrupt = false;
+		host_clearWire();
+		spi_freeRTOSTranceive(words, lengths[i], legacyCallback, answer);
+		HOST_CHECK(legacy_calls == 1);
+		HOST_CHECK(legacy_called_in_interrupt);
+		HOST_CHECK(host_wireLength == lengths[i]);
+	}
+	// Without a callback a short transfer is polled
+	uint32_t interrupts = host_counters.interrupts;
+	spi_freeRTOSTranceive(words, 1, NULL, answer);
+	HOST_CHECK(host_counters.interrupts == interrupts);
+}
+
+// A blocking transfer is queued under the chip select in its words, so it goes out after the transfers 
+// to the same device that were submitted before it, and not ahead of them on another queue
+static void testChipSelectOrder(void) {
+	static uint32_t words[3][20];
+	static struct SpiTransfer queued[2];
+	for (uint32_t i = 0; i < 3; i++) {
+		for (uint32_t j = 0; j < 20; j++) {
+			words[i][j] = spi_word(j == 19, NPCS1, i * 100 + j);
+		}
+	}
+	host_clearWire();
+	for (uint32_t i = 0; i < 2; i++) {
+		queued[i] = (struct SpiTransfer){ .transmit_buffer = words[i], .buffer_length = 20, .chip_select = NPCS1 };
+		spi_submitTransfer(&queued[i]);
+	}
+	spi_freeRTOSTranceive(words[2], 20, legacyCallback, NULL);
+	host_idle();
+	HOST_CHECK(host_wireLength == 60);
+	for (uint32_t k = 0; k < 60; k++) {
+		HOST_CHECK(host_wire[k].data == words[k / 20][k % 20]);
+		HOST_CHECK(host_wire[k].chip_select == NPCS1);
+	}
+}
+
+// Transfers that follow each other in memory go out as one PDC run, which takes fewer interrupts, unless 
+// a transfer ends with LASTXFER. The words go out as they are in the buffers, which are left as they were.
+static void testCoalescing(void) {
+	static uint32_t words[12];
+	static struct SpiTransfer transfers[3];
+	uint32_t interrupts_per_case[2];
+	for (uint8_t ends_with_last = 0; ends_with_last < 2; ends_with_last++) {
+		for (uint32_t i = 0; i < 12; i++) {
+			words[i] = spi_word(ends_with_last && ((i % 4) == 3), NPCS1, i);
+		}
+		host_clearWire();
+		uint32_t interrupts = host_counters.interrupts;
+		taskENTER_CRITICAL(); // Queue all three before the first is started
+		for (uint32_t i = 0; i < 3; i++) {
+			transfers[i] = (struct SpiTransfer){ .transmit_buffer = &words[4 * i], .buffer_length = 4, .chip_select = NPCS1 };
+			spi_submitTransfer(&transfers[i]);
+		}
+		taskEXIT_CRITICAL();
+		host_idle();
+		HOST_CHECK(host_wireLength == 12);
+		for (uint32_t i = 0; i < 12; i++) {
+			HOST_CHECK(spi_transferIsDone(&transfers[i / 4]));
+			HOST_CHECK(words[i] == spi_word(ends_with_last && ((i % 4) == 3), NPCS1, i));
+			HOST_CHECK(host_wire[i].data == words[i]);
+		}
+		interrupts_per_case[ends_with_last] = host_counters.interrupts - interrupts;
+	}
+	HOST_CHECK(interrupts_per_case[0] < interrupts_per_case[1]);
+}
+
+// A long transfer to a low priority chip select that may hold the bus for MAX_HOLD words is preempted 
+// by short transfers to a high priority chip select. Each short transfer has to get onto the bus within 
+// two chunks of the long one (the chunk being sent and the one preloaded behind it), and the long one 
+// has to go on from where it was cut, at a chunk boundary, without losing or repeating a word.
+#define LONG_WORDS	1000
+#define MAX_HOLD	32
+#define URGENT_COUNT	3
+#define URGENT_WORDS	10
+
+static void testPreemption(void) {
+	static uint32_t long_words[LONG_WORDS];
+	static uint32_t urgent_words[URGENT_COUNT][URGENT_WORDS];
+	static struct SpiTransfer long_transfer;
+	static struct SpiTransfer urgent[URGENT_COUNT];
+	for (uint8_t chip_select = NPCS0; chip_select <= NPCS1; chip_select++) {
+		spi_chipSelectInit((struct SpiSlaveSettings){ .chip_select = chip_select, .peripheral_clock_hz = 100000000, 
+			.spi_mode = MODE_0, .spi_baudRate_hz = 25000000, .bits_per_transfer = 9 });
+	}
+	for (uint32_t i = 0; i < LONG_WORDS; i++) {
+		long_words[i] = spi_word(i == LONG_WORDS - 1, NPCS0, i & 0xFF);
+	}
+	spi_setChipSelectQos(NPCS0, (struct SpiQos){ .priority = 0, .max_hold_words = MAX_HOLD });
+	spi_setChipSelectQos(NPCS1, (struct SpiQos){ .priority = 1, .max_hold_words = 0 });
+	spi_resetStatistics();
+	host_clearWire();
+	
+	long_transfer = (struct SpiTransfer){ .transmit_buffer = long_words, .buffer_length = LONG_WORDS, 
+		.chip_select = NPCS0, .notify_task = xTaskGetCurrentTaskHandle() };
+	spi_submitTransfer(&long_transfer);
+	uint32_t wire_at_submit[URGENT_COUNT];
+	for (uint32_t i = 0; i < URGENT_COUNT; i++) {
+		host_run(5000 + i * 3000);
+		for (uint32_t j = 0; j < URGENT_WORDS; j++) {
+			urgent_words[i][j] = spi_word(j == URGENT_WORDS - 1, NPCS1, 0x100 | (i << 4) | j);
+		}
+		urgent[i] = (struct SpiTransfer){ .transmit_buffer = urgent_words[i], .buffer_length = URGENT_WORDS, 
+			.chip_select = NPCS1 };
+		wire_at_submit[i] = host_wireLength;
+		spi_submitTransfer(&urgent[i]);
+	}
+	HOST_CHECK(spi_waitForTransfer(&long_transfer) == SPI_TRANSFER_DONE);
+	host_idle();
+	
+	// The wire is the long transfer in order, with every urgent transfer inserted at a chunk boundary
+	HOST_CHECK(host_wireLength == LONG_WORDS + URGENT_COUNT * URGENT_WORDS);
+	uint32_t long_index = 0;
+	uint32_t urgent_index = 0;
+	for (uint32_t k = 0; k < host_wireLength; ) {
+		if (host_wire[k].chip_select == NPCS1) {
+			HOST_CHECK(urgent_index < URGENT_COUNT);
+			HOST_CHECK(long_index % MAX_HOLD == 0);
+			HOST_CHECK(k <= wire_at_submit[urgent_index] + 2 * MAX_HOLD + 1);
+			for (uint32_t j = 0; j < URGENT_WORDS; j++, k++) {
+				HOST_CHECK(host_wire[k].data == urgent_words[urgent_index][j]);
+			}
+			urgent_index++;
+		}
+		else {
+			HOST_CHECK(host_wire[k].data == long_words[long_index]);
+			long_index++;
+			k++;
+		}
+	}
+	HOST_CHECK((long_index == LONG_WORDS) && (urgent_index == URGENT_COUNT));
+	
+	struct SpiStatistics statistics;
+	spi_getStatistics(NPCS0, &statistics);
+	HOST_CHECK(statistics.preemptions == URGENT_COUNT);
+	HOST_CHECK((statistics.transfers == 1) && (statistics.words == LONG_WORDS));
+	spi_getStatistics(NPCS1, &statistics);
+	HOST_CHECK((statistics.preemptions == 0) && (statistics.transfers == URGENT_COUNT));
+	// 2 chunks of 32 words of 36 cycles, and the interrupt in between
+	HOST_CHECK(statistics.max_wait_cycles <= 2 * MAX_HOLD * 36 + 1000);
+	
+	spi_setChipSelectQos(NPCS0, (struct SpiQos){ 0 });
+	spi_setChipSelectQos(NPCS1, (struct SpiQos){ 0 });
+}
+
+static void test(void) {
+	spi_masterInit((struct SpiMaster){ .NVIC_spi_interrupt_priority = 10, .cs_0 = PA11, .cs_1 = PA31 });
+	testTwoTransfers();
+	testManyTransfers();
+	testLegacyCallback();
+	testChipSelectOrder();
+	testCoalescing();
+	testPreemption();
+	printf("ok, %u interrupts\n", host_counters.interrupts);
+}
+
+int main(void) {
+	return host_main(test);
+}
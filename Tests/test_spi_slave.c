@@ -0,0 +1,108 @@
+#include "host.h"
+#include "spi.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// A master sends a stream to the slave, and a reader takes it out of the ring block by block. Everything
+// has to arrive in order, also when the positions in the ring wrap at 2^32. A reader that stops releasing
+// the ring loses what comes after the ring is full, and has to get the next stream again after a release.
+
+#define RING_LENGTH	64
+#define BLOCK_LENGTH	16
+#define STREAM_LENGTH	300
+#define STALL_LENGTH	200
+
+static uint8_t ring[RING_LENGTH];
+static uint32_t sent[STREAM_LENGTH];
+static uint8_t received[STREAM_LENGTH];
+
+static void slaveInit(void) {
+	spi_slaveInit((struct SpiSlave){
+		.NVIC_spi_interrupt_priority = 10,
+		.spi_mode = MODE_0,
+		.bits_per_transfer = 8,
+		.ring_buffer = ring,
+		.ring_length = RING_LENGTH,
+		.block_length = BLOCK_LENGTH
+	});
+}
+
+// Reads until length bytes have arrived, and checks them against sent
+static void receiveAll(uint32_t length) {
+	uint32_t count = 0;
+	while (count < length) {
+		const void *data;
+		uint32_t received_length = spi_slaveReceive(&data, portMAX_DELAY);
+		HOST_CHECK((received_length > 0) && (count + received_length <= length));
+		HOST_CHECK(((const uint8_t *)data >= ring) && ((const uint8_t *)data + received_length <= ring + RING_LENGTH));
+		memcpy(&received[count], data, received_length);
+		count += received_length;
+		spi_slaveRelease(received_length);
+	}
+	for (uint32_t i = 0; i < length; i++) {
+		HOST_CHECK(received[i] == sent[i]);
+	}
+}
+
+static void receiveStream(uint32_t first_position) {
+	slaveInit();
+	// The ring is empty, so moving every position by a multiple of its length changes nothing but the numbers
+	spi_slaveSkipPositions(first_position);
+
+	for (uint32_t i = 0; i < STREAM_LENGTH; i++) {
+		sent[i] = (i * 13 + first_position) & 0xFF;
+	}
+	host_masterSend(sent, STREAM_LENGTH);
+	receiveAll(STREAM_LENGTH);
+	host_idle();
+	HOST_CHECK(host_masterPending() == 0);
+	struct SpiSlaveStatistics statistics;
+	spi_slaveGetStatistics(&statistics);
+	HOST_CHECK((statistics.stalls == 0) && (statistics.overruns == 0));
+	HOST_CHECK(statistics.bytes_received == STREAM_LENGTH);
+}
+
+static void receiveAfterStall(void) {
+	slaveInit();
+	const void *data;
+	HOST_CHECK(spi_slaveReceive(&data, 10) == 0);
+
+	// Nobody reads while the master sends more than the ring holds
+	for (uint32_t i = 0; i < STALL_LENGTH; i++) {
+		sent[i] = (i * 7 + 1) & 0xFF;
+	}
+	host_masterSend(sent, STALL_LENGTH);
+	host_idle();
+	HOST_CHECK(host_masterPending() == 0);
+	struct SpiSlaveStatistics statistics;
+	spi_slaveGetStatistics(&statistics);
+	HOST_CHECK((statistics.stalls == 1) && (statistics.overruns > 0));
+	HOST_CHECK(statistics.bytes_received == RING_LENGTH);
+	// The ring holds the start of the stream, the rest is lost
+	receiveAll(RING_LENGTH);
+	HOST_CHECK(spi_slaveReceive(&data, 10) == 0);
+
+	// Releasing the ring restarted the PDC, so the next stream arrives whole
+	for (uint32_t i = 0; i < STREAM_LENGTH; i++) {
+		sent[i] = (i * 5 + 3) & 0xFF;
+	}
+	host_masterSend(sent, STREAM_LENGTH);
+	receiveAll(STREAM_LENGTH);
+	host_idle();
+	struct SpiSlaveStatistics after;
+	spi_slaveGetStatistics(&after);
+	HOST_CHECK((after.stalls == statistics.stalls) && (after.overruns == statistics.overruns));
+	HOST_CHECK(after.bytes_received == RING_LENGTH + STREAM_LENGTH);
+}
+
+static void test(void) {
+	receiveStream(0);
+	receiveStream(0u - 2 * RING_LENGTH);
+	receiveAfterStall();
+	printf("ok\n");
+}
+
+int main(void) {
+	return host_main(test);
+}
@@ -0,0 +1,58 @@
+#include "host.h"
+#include "spi.h"
+#include "ili9341.h"
+#include "ili9341_emulator.h"
+
+#include <stdio.h>
+
+// The display is on NPCS1, and everything the driver sends it is counted there: short commands that
+// are polled as well as pixel data that goes through the PDC.
+
+static struct Ili9341Emulator panel;
+
+static void checkNothingOnNpcs0(void) {
+	struct SpiStatistics statistics;
+	spi_getStatistics(NPCS0, &statistics);
+	HOST_CHECK((statistics.transfers == 0) && (statistics.words == 0) && (statistics.busy_cycles == 0));
+}
+
+static void testPolled(void) {
+	struct SpiStatistics statistics;
+	spi_resetStatistics();
+	host_clearWire();
+	uint32_t interrupts = host_counters.interrupts;
+	ili9341_setScrollStart(10);
+	host_idle();
+	HOST_CHECK(host_counters.interrupts == interrupts);
+	spi_getStatistics(NPCS1, &statistics);
+	HOST_CHECK(statistics.transfers >= 1);
+	HOST_CHECK(statistics.words == host_wireLength);
+	checkNothingOnNpcs0();
+}
+
+static void testPdc(void) {
+	struct SpiStatistics statistics;
+	spi_resetStatistics();
+	host_clearWire();
+	uint32_t interrupts = host_counters.interrupts;
+	ili9341_fillRect(0, 0, 100, 100, 0xF800);
+	host_idle();
+	HOST_CHECK(host_counters.interrupts > interrupts);
+	spi_getStatistics(NPCS1, &statistics);
+	HOST_CHECK(statistics.transfers >= 1);
+	HOST_CHECK(statistics.words == host_wireLength);
+	HOST_CHECK(statistics.busy_cycles > 0);
+	checkNothingOnNpcs0();
+}
+
+static void test(void) {
+	host_initDisplay(&panel);
+	ili9341_init();
+	testPolled();
+	testPdc();
+	printf("ok\n");
+}
+
+int main(void) {
+	return host_main(test);
+}
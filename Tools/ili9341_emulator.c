@@ -0,0 +1,249 @@
+#include "ili9341_emulator.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// The commands the emulator models, from Drivers/ili9341/ili9341_regs.h
+#define CMD_COLUMN_ADDRESS_SET	0x2A
+#define CMD_PAGE_ADDRESS_SET	0x2B
+#define CMD_MEMORY_WRITE	0x2C
+#define CMD_MEMORY_READ	0x2E
+#define CMD_VERT_SCROLL_DEFINITION	0x33
+#define CMD_MEMORY_ACCESS_CONTROL	0x36
+#define CMD_VERT_SCROLL_START_ADDRESS	0x37
+#define CMD_WRITE_MEMORY_CONTINUE	0x3C
+#define CMD_READ_MEMORY_CONTINUE	0x3E
+
+#define MADCTL_MY	0x80
+#define MADCTL_MX	0x40
+#define MADCTL_MV	0x20
+#define MADCTL_BGR	0x08
+
+void ili9341_emulatorInit(struct Ili9341Emulator *emulator) {
+	memset(emulator, 0, sizeof(*emulator));
+	emulator->column_end = ILI9341_EMULATOR_WIDTH - 1;
+	emulator->page_end = ILI9341_EMULATOR_HEIGHT - 1;
+	emulator->scroll_height = ILI9341_EMULATOR_HEIGHT;
+}
+
+// Where a pixel at the MCU address column, page goes in memory. MX and MY mirror the addresses, MV exchanges them.
+static uint16_t *gramAt(struct Ili9341Emulator *emulator, uint16_t column, uint16_t page) {
+	bool exchanged = (emulator->madctl & MADCTL_MV) != 0;
+	uint16_t columns = exchanged ? ILI9341_EMULATOR_HEIGHT : ILI9341_EMULATOR_WIDTH;
+	uint16_t pages = exchanged ? ILI9341_EMULATOR_WIDTH : ILI9341_EMULATOR_HEIGHT;
+	if ((column >= columns) || (page >= pages)) {
+		return NULL;
+	}
+	if (emulator->madctl & MADCTL_MX) {
+		column = columns - 1 - column;
+	}
+	if (emulator->madctl & MADCTL_MY) {
+		page = pages - 1 - page;
+	}
+	if (exchanged) {
+		return &emulator->gram[column][page];
+	}
+	return &emulator->gram[page][column];
+}
+
+// The window is filled column by column and page by page, and starts over when it is full
+static uint16_t *nextPixel(struct Ili9341Emulator *emulator) {
+	uint16_t *pixel = gramAt(emulator, emulator->column, emulator->page);
+	if (emulator->column < emulator->column_end) {
+		emulator->column++;
+		return pixel;
+	}
+	emulator->column = emulator->column_start;
+	emulator->page = (emulator->page < emulator->page_end) ? (emulator->page + 1) : emulator->page_start;
+	return pixel;
+}
+
+static void startCommand(struct Ili9341Emulator *emulator, uint8_t command) {
+	emulator->frame.commands++;
+	emulator->command = command;
+	emulator->parameter_count = 0;
+	emulator->pixel_byte = 0;
+	emulator->read_bytes = 0;
+	emulator->reading = (command == CMD_MEMORY_READ) || (command == CMD_READ_MEMORY_CONTINUE);
+	if ((command == CMD_MEMORY_WRITE) || (command == CMD_MEMORY_READ)) {
+		emulator->column = emulator->column_start;
+		emulator->page = emulator->page_start;
+	}
+}
+
+// Parameters are used once the command has all of them
+static void addParameter(struct Ili9341Emulator *emulator, uint8_t byte) {
+	emulator->frame.parameters++;
+	if (emulator->parameter_count < sizeof(emulator->parameters)) {
+		emulator->parameters[emulator->parameter_count++] = byte;
+	}
+	const uint8_t *parameters = emulator->parameters;
+	switch (emulator->command) {
+		case CMD_COLUMN_ADDRESS_SET:
+		if (emulator->parameter_count == 4) {
+			emulator->column_start = (parameters[0] << 8) | parameters[1];
+			emulator->column_end = (parameters[2] << 8) | parameters[3];
+		}
+		break;
+		case CMD_PAGE_ADDRESS_SET:
+		if (emulator->parameter_count == 4) {
+			emulator->page_start = (parameters[0] << 8) | parameters[1];
+			emulator->page_end = (parameters[2] << 8) | parameters[3];
+		}
+		break;
+		case CMD_MEMORY_ACCESS_CONTROL:
+		if (emulator->parameter_count == 1) {
+			emulator->madctl = parameters[0];
+		}
+		break;
+		case CMD_VERT_SCROLL_DEFINITION:
+		if (emulator->parameter_count == 6) {
+			emulator->top_fixed = (parameters[0] << 8) | parameters[1];
+			emulator->scroll_height = (parameters[2] << 8) | parameters[3];
+			emulator->bottom_fixed = (parameters[4] << 8) | parameters[5];
+		}
+		break;
+		case CMD_VERT_SCROLL_START_ADDRESS:
+		if (emulator->parameter_count == 2) {
+			emulator->scroll_start = (parameters[0] << 8) | parameters[1];
+		}
+		break;
+		default:
+		break;
+	}
+}
+
+static void writeByte(struct Ili9341Emulator *emulator, uint8_t byte) {
+	if (emulator->pixel_byte == 0) {
+		emulator->pixel_high = byte;
+		emulator->pixel_byte = 1;
+		return;
+	}
+	emulator->pixel_byte = 0;
+	emulator->frame.pixels_written++;
+	uint16_t *pixel = nextPixel(emulator);
+	if (pixel != NULL) {
+		*pixel = (emulator->pixel_high << 8) | byte;
+	}
+}
+
+// A read answers a dummy byte, then red, green and blue of every pixel with 6 bits each in the top bits
+static uint8_t readByte(struct Ili9341Emulator *emulator) {
+	uint32_t index = emulator->read_bytes++;
+	if (index == 0) {
+		return 0;
+	}
+	uint8_t channel = (index - 1) % 3;
+	if (channel == 0) {
+		uint16_t *pixel = nextPixel(emulator);
+		emulator->read_pixel = (pixel != NULL) ? *pixel : 0;
+		emulator->frame.pixels_read++;
+	}
+	uint16_t color = emulator->read_pixel;
+	uint8_t red = color >> 11;
+	uint8_t green = (color >> 5) & 0x3F;
+	uint8_t blue = color & 0x1F;
+	switch (channel) {
+		case 0:
+		return ((red << 1) | (red >> 4)) << 2;
+		case 1:
+		return green << 2;
+		default:
+		return ((blue << 1) | (blue >> 4)) << 2;
+	}
+}
+
+static uint8_t dataByte(struct Ili9341Emulator *emulator, uint8_t byte) {
+	switch (emulator->command) {
+		case CMD_MEMORY_WRITE:
+		case CMD_WRITE_MEMORY_CONTINUE:
+		writeByte(emulator, byte);
+		return 0;
+		case CMD_MEMORY_READ:
+		case CMD_READ_MEMORY_CONTINUE:
+		return readByte(emulator);
+		default:
+		addParameter(emulator, byte);
+		return 0;
+	}
+}
+
+uint8_t ili9341_emulatorWord9(struct Ili9341Emulator *emulator, uint16_t word) {
+	emulator->frame.words++;
+	if (word & 0x100) {
+		return dataByte(emulator, word & 0xFF);
+	}
+	startCommand(emulator, word & 0xFF);
+	return 0;
+}
+
+void ili9341_emulatorWords(struct Ili9341Emulator *emulator, const uint32_t *words, uint32_t count, uint32_t *miso) {
+	for (uint32_t i = 0; i < count; i++) {
+		uint8_t answer = ili9341_emulatorWord9(emulator, words[i] & 0x1FF);
+		if (miso != NULL) {
+			miso[i] = answer;
+		}
+	}
+}
+
+// While the panel answers a read it does not look at D/C, so the clocks for the answer may be sent with D/C low
+uint8_t ili9341_emulatorByte(struct Ili9341Emulator *emulator, bool data, uint8_t byte) {
+	emulator->frame.words++;
+	if (data || emulator->reading) {
+		return dataByte(emulator, byte);
+	}
+	startCommand(emulator, byte);
+	return 0;
+}
+
+void ili9341_emulatorEndTransfer(struct Ili9341Emulator *emulator) {
+	emulator->reading = false;
+}
+
+void ili9341_emulatorPixel16(struct Ili9341Emulator *emulator, uint16_t pixel) {
+	emulator->frame.words++;
+	dataByte(emulator, pixel >> 8);
+	dataByte(emulator, pixel & 0xFF);
+}
+
+void ili9341_emulatorEndFrame(struct Ili9341Emulator *emulator, struct Ili9341EmulatorFrame *frame) {
+	*frame = emulator->frame;
+	memset(&emulator->frame, 0, sizeof(emulator->frame));
+}
+
+// The panel is mounted so that the default MADCTL of the driver (MX and BGR) shows the picture the right way round
+uint16_t ili9341_emulatorShownPixel(const struct Ili9341Emulator *emulator, uint16_t x, uint16_t y) {
+	uint16_t row = y;
+	uint16_t top = emulator->top_fixed;
+	uint16_t height = emulator->scroll_height;
+	if ((height > 0) && (y >= top) && (y < top + height)) {
+		row = top + ((emulator->scroll_start + height - top) % height + (y - top)) % height;
+	}
+	uint16_t color = emulator->gram[row][ILI9341_EMULATOR_WIDTH - 1 - x];
+	if (!(emulator->madctl & MADCTL_BGR)) {
+		color = (color & 0x07E0) | (color >> 11) | (color << 11);
+	}
+	return color;
+}
+
+bool ili9341_emulatorWritePPM(const struct Ili9341Emulator *emulator, const char *path) {
+	FILE *file = fopen(path, "wb");
+	if (file == NULL) {
+		return false;
+	}
+	fprintf(file, "P6\n%d %d\n255\n", ILI9341_EMULATOR_WIDTH, ILI9341_EMULATOR_HEIGHT);
+	for (uint16_t y = 0; y < ILI9341_EMULATOR_HEIGHT; y++) {
+		uint8_t row[3 * ILI9341_EMULATOR_WIDTH];
+		for (uint16_t x = 0; x < ILI9341_EMULATOR_WIDTH; x++) {
+			uint16_t color = ili9341_emulatorShownPixel(emulator, x, y);
+			uint8_t red = color >> 11;
+			uint8_t green = (color >> 5) & 0x3F;
+			uint8_t blue = color & 0x1F;
+			row[3*x] = (red << 3) | (red >> 2);
+			row[3*x + 1] = (green << 2) | (green >> 4);
+			row[3*x + 2] = (blue << 3) | (blue >> 2);
+		}
+		fwrite(row, 1, sizeof(row), file);
+	}
+	return fclose(file) == 0;
+}
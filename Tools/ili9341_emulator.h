@@ -0,0 +1,100 @@
+#ifndef ILI9341_EMULATOR_H_
+#define ILI9341_EMULATOR_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Host stand-in for the ILI9341, for running the drawing code of Drivers/ili9341 without a panel.
+// It takes the words the driver puts on the bus and models what the panel does with them:
+// CASET, PASET, RAMWR, Write Memory Continue, RAMRD, Read Memory Continue, MADCTL, VSCRDEF and VSCRSADD
+// go into a GRAM array, every other command is counted and ignored. What the panel would show can be
+// read back pixel by pixel or dumped as a PPM file, and the bus words are counted per frame.
+//
+// A host build of the SPI layer hands every word of a transfer to the emulator, for example:
+//
+//	static struct Ili9341Emulator panel;
+//	ili9341_emulatorInit(&panel);
+//	// in the transfer function, for SPI_FORMAT_PDC_WORD buffers of the 3-wire mode
+//	ili9341_emulatorWords(&panel, transmit_buffer, length, receive_buffer);
+//	// and when the chip select goes high at the end of the transfer
+//	ili9341_emulatorEndTransfer(&panel);
+//	...
+//	ili9341_drawLine(0, 0, 239, 319, 0xF800);
+//	struct Ili9341EmulatorFrame frame;
+//	ili9341_emulatorEndFrame(&panel, &frame);
+//	ili9341_emulatorWritePPM(&panel, "line.ppm");
+//
+// Build it with the host compiler alongside the code under test, it has no other dependencies. The register
+// model in Tests/host feeds it this way; Tests/test_ili9341_golden checks its pictures against golden hashes
+// and Tests/bench_ili9341_frame prints its counters for every scene.
+
+#define ILI9341_EMULATOR_WIDTH	240
+#define ILI9341_EMULATOR_HEIGHT	320
+
+/* Bus traffic since the last ili9341_emulatorEndFrame */
+struct Ili9341EmulatorFrame {
+	/* Every word on the bus: 9-bit words in 3-wire mode, 8 and 16-bit transfers in 4-wire mode */
+	uint32_t words;
+	uint32_t commands;
+	/* Parameter bytes of commands other than memory writes and reads */
+	uint32_t parameters;
+	uint32_t pixels_written;
+	uint32_t pixels_read;
+};
+
+struct Ili9341Emulator {
+	/* Memory as the panel stores it, row by row */
+	uint16_t gram[ILI9341_EMULATOR_HEIGHT][ILI9341_EMULATOR_WIDTH];
+
+	uint8_t command;
+	uint8_t parameters[8];
+	uint8_t parameter_count;
+	uint8_t madctl;
+	/* Window, in the addresses the MCU uses */
+	uint16_t column_start;
+	uint16_t column_end;
+	uint16_t page_start;
+	uint16_t page_end;
+	/* Position of the next pixel in the window */
+	uint16_t column;
+	uint16_t page;
+	/* A pixel is sent as two bytes */
+	uint8_t pixel_high;
+	uint8_t pixel_byte;
+	/* Bytes a read has answered so far */
+	uint32_t read_bytes;
+	uint16_t read_pixel;
+	/* Set by a read command until the chip select goes high */
+	bool reading;
+
+	uint16_t top_fixed;
+	uint16_t scroll_height;
+	uint16_t bottom_fixed;
+	uint16_t scroll_start;
+
+	struct Ili9341EmulatorFrame frame;
+};
+
+void ili9341_emulatorInit(struct Ili9341Emulator *emulator);
+
+// One 9-bit word of the 3-wire interface, bit 8 set for data. Returns the byte the panel shifts out 
+// meanwhile, for reads.
+uint8_t ili9341_emulatorWord9(struct Ili9341Emulator *emulator, uint16_t word);
+// spi_word buffers of the 3-wire interface. miso gets the answer as the SPI would receive it, or is NULL.
+void ili9341_emulatorWords(struct Ili9341Emulator *emulator, const uint32_t *words, uint32_t count, uint32_t *miso);
+// One 8-bit transfer of the 4-wire interface, with the level of the D/C pin
+uint8_t ili9341_emulatorByte(struct Ili9341Emulator *emulator, bool data, uint8_t byte);
+// One 16-bit pixel transfer of the 4-wire interface, sent with D/C high
+void ili9341_emulatorPixel16(struct Ili9341Emulator *emulator, uint16_t pixel);
+// The chip select went high. This ends a read, which in 4-wire mode is clocked with D/C low.
+void ili9341_emulatorEndTransfer(struct Ili9341Emulator *emulator);
+
+// Takes the counters of the frame and starts the next one
+void ili9341_emulatorEndFrame(struct Ili9341Emulator *emulator, struct Ili9341EmulatorFrame *frame);
+
+// The RGB565 color the panel shows at x, y, with scrolling and the MADCTL color order applied
+uint16_t ili9341_emulatorShownPixel(const struct Ili9341Emulator *emulator, uint16_t x, uint16_t y);
+// Writes what the panel shows as a binary PPM. Returns false if the file could not be written.
+bool ili9341_emulatorWritePPM(const struct Ili9341Emulator *emulator, const char *path);
+
+#endif /* ILI9341_EMULATOR_H_ */
@@ -0,0 +1,159 @@
+// Converts a binary PPM (P6) file into a C source with a run length compressed struct Ili9341Image,
+// in the format Drivers/ili9341/ili9341_image.h describes. Runs on the host, any C99 compiler will do:
+//
+//	cc -std=c99 -O2 -o ili9341_imageconv ili9341_imageconv.c
+//	ili9341_imageconv splash.ppm splash > splash.c
+//
+// Colors are rounded to RGB565 the same way ili9341_convertRGB888 does it.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define IMAGE_RUN	0x80
+#define IMAGE_MAX_COUNT	128
+// A run this long is shorter than the same pixels in a literal packet, even if the literal has to be split for it
+#define MIN_RUN	3
+
+static int skipSpaceAndComments(FILE *file) {
+	int c = fgetc(file);
+	while ((c == ' ') || (c == '\t') || (c == '\r') || (c == '\n') || (c == '#')) {
+		if (c == '#') {
+			while ((c != '\n') && (c != EOF)) {
+				c = fgetc(file);
+			}
+		}
+		c = fgetc(file);
+	}
+	return c;
+}
+
+static int readNumber(FILE *file, unsigned *value) {
+	int c = skipSpaceAndComments(file);
+	if ((c < '0') || (c > '9')) {
+		return 0;
+	}
+	*value = 0;
+	while ((c >= '0') && (c <= '9')) {
+		*value = *value * 10 + (c - '0');
+		c = fgetc(file);
+	}
+	// One whitespace character ends the header
+	return 1;
+}
+
+static unsigned roundChannel(unsigned value, unsigned bits) {
+	value += 1u << (7 - bits);
+	if (value > 255) {
+		value = 255;
+	}
+	return value >> (8 - bits);
+}
+
+static uint16_t *readPPM(const char *path, unsigned *width, unsigned *height) {
+	FILE *file = fopen(path, "rb");
+	if (file == NULL) {
+		perror(path);
+		return NULL;
+	}
+	unsigned maximum;
+	if ((fgetc(file) != 'P') || (fgetc(file) != '6') || !readNumber(file, width) || !readNumber(file, height) ||
+		!readNumber(file, &maximum) || (maximum != 255) || (*width == 0) || (*height == 0) || (*width > 0xFFFF) || (*height > 0xFFFF)) {
+		fprintf(stderr, "%s: not a binary PPM with 8 bits per channel\n", path);
+		fclose(file);
+		return NULL;
+	}
+	size_t count = (size_t)*width * *height;
+	uint16_t *pixels = malloc(count * sizeof(uint16_t));
+	for (size_t i = 0; (pixels != NULL) && (i < count); i++) {
+		unsigned char rgb[3];
+		if (fread(rgb, 1, 3, file) != 3) {
+			fprintf(stderr, "%s: file ends early\n", path);
+			free(pixels);
+			pixels = NULL;
+			break;
+		}
+		pixels[i] = (roundChannel(rgb[0], 5) << 11) | (roundChannel(rgb[1], 6) << 5) | roundChannel(rgb[2], 5);
+	}
+	fclose(file);
+	return pixels;
+}
+
+static size_t runLength(const uint16_t *pixels, size_t position, size_t count) {
+	size_t length = 1;
+	while ((position + length < count) && (length < IMAGE_MAX_COUNT) && (pixels[position + length] == pixels[position])) {
+		length++;
+	}
+	return length;
+}
+
+static size_t output_bytes = 0;
+
+static void putByte(uint8_t byte) {
+	printf("%s0x%02X,", (output_bytes % 16 == 0) ? "\n\t" : " ", byte);
+	output_bytes++;
+}
+
+static void putPixel(uint16_t pixel) {
+	putByte(pixel >> 8);
+	putByte(pixel & 0xFF);
+}
+
+static void putLiteral(const uint16_t *pixels, size_t count) {
+	putByte(count - 1);
+	for (size_t i = 0; i < count; i++) {
+		putPixel(pixels[i]);
+	}
+}
+
+// Runs are taken where they save space, everything else goes into literal packets
+static void encode(const uint16_t *pixels, size_t count) {
+	size_t literal_start = 0;
+	size_t position = 0;
+	while (position < count) {
+		size_t run = runLength(pixels, position, count);
+		if ((run >= MIN_RUN) || ((run >= 2) && (literal_start == position))) {
+			if (literal_start < position) {
+				putLiteral(&pixels[literal_start], position - literal_start);
+			}
+			putByte(IMAGE_RUN | (run - 1));
+			putPixel(pixels[position]);
+			position += run;
+			literal_start = position;
+		}
+		else {
+			position++;
+			if (position - literal_start == IMAGE_MAX_COUNT) {
+				putLiteral(&pixels[literal_start], IMAGE_MAX_COUNT);
+				literal_start = position;
+			}
+		}
+	}
+	if (literal_start < position) {
+		putLiteral(&pixels[literal_start], position - literal_start);
+	}
+}
+
+int main(int argc, char **argv) {
+	if (argc != 3) {
+		fprintf(stderr, "usage: %s image.ppm name > name.c\n", argv[0]);
+		return 1;
+	}
+	unsigned width;
+	unsigned height;
+	uint16_t *pixels = readPPM(argv[1], &width, &height);
+	if (pixels == NULL) {
+		return 1;
+	}
+	const char *name = argv[2];
+	printf("// Made by ili9341_imageconv from %s\n\n", argv[1]);
+	printf("#include \"ili9341_image.h\"\n\n");
+	printf("static const uint8_t %s_data[] = {", name);
+	encode(pixels, (size_t)width * height);
+	printf("\n};\n\n");
+	printf("const struct Ili9341Image %s = {%u, %u, %s_data, sizeof(%s_data)};\n", name, width, height, name, name);
+	fprintf(stderr, "%s: %ux%u, %zu bytes instead of %zu\n", name, width, height, output_bytes, (size_t)width * height * 2);
+	free(pixels);
+	return 0;
+}